@@ -0,0 +1,302 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+
+#include "powermate.h"
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STEPS POWERMATE_CURVE_STEPS
+
+
+/* Curves map the animation progress (0 ... STEPS - 1) to the fraction
+(0 ... 255) of the way from the start to the end brightness. They are
+built once with integer arithmetic. */
+
+static void powermate_animator_build_curves(PowerMateAnimator *animator)
+{
+	unsigned int step, t, v;
+
+	for (step = 0; step < STEPS; step++) {
+		t = step * 255 / (STEPS - 1);
+		animator->curves[POWERMATE_CURVE_LINEAR][step] = (unsigned char)t;
+
+		/* Smoothstep, 3t² - 2t³ */
+
+		animator->curves[POWERMATE_CURVE_EASE][step] =
+			(unsigned char)(t * t * (765 - 2 * t) / (255 * 255));
+
+		/* Smoothstep over a triangle, squared as the eye is
+		more sensitive to changes in dim light */
+
+		t = step < STEPS / 2 ? step * 2 * 255 / (STEPS - 1) : (STEPS - 1 - step) * 2 * 255 / (STEPS - 1);
+		v = t * t * (765 - 2 * t) / (255 * 255);
+		animator->curves[POWERMATE_CURVE_BREATHE][step] = (unsigned char)(v * v / 255);
+	}
+}
+
+
+static long long int powermate_animator_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long int)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* rate is the maximum of frames (and so writes per device) per second */
+
+PowerMateAnimator *powermate_animator_new(unsigned int rate)
+{
+	PowerMateAnimator *animator;
+
+	if (!rate || rate > 1000) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((animator = (PowerMateAnimator *)calloc(1, sizeof(PowerMateAnimator))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((animator->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+		free(animator);
+		return NULL;
+	}
+
+	animator->rate = rate;
+	powermate_animator_build_curves(animator);
+	return animator;
+}
+
+
+/* Devices still animated are detached and keep their last level */
+
+int powermate_animator_destroy(PowerMateAnimator *animator)
+{
+	unsigned int index;
+
+	for (index = 0; index < animator->count; index++)
+		animator->animations[index].pm->animator = NULL;
+
+	close(animator->fd);
+	free(animator->animations);
+	free(animator);
+	return 0;
+}
+
+
+static int powermate_animator_arm(PowerMateAnimator *animator, int armed)
+{
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+
+	if (armed) {
+		spec.it_interval.tv_nsec = 1000000000L / animator->rate;
+		spec.it_value = spec.it_interval;
+	}
+
+	if (timerfd_settime(animator->fd, 0, &spec, NULL)) return -1;
+	animator->armed = armed;
+	return 0;
+}
+
+
+/* Replaces the animation of pm, if any, or adds a new one. A device
+animated by another animator is taken from it. */
+
+static int powermate_animator_set(
+	PowerMateAnimator *animator,
+	PowerMate *pm,
+	PowerMateCurve curve,
+	unsigned char from,
+	unsigned char to,
+	int repeat,
+	unsigned int duration
+){
+	PowerMateAnimation *animation, *a;
+	unsigned int index;
+
+	if (curve >= POWERMATE_CURVES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pm->animator != NULL && pm->animator != animator) powermate_animator_stop(pm->animator, pm);
+	if (!animator->armed && powermate_animator_arm(animator, 1)) return -1;
+
+	for (index = 0; index < animator->count; index++)
+		if (animator->animations[index].pm == pm) break;
+
+	if (index == animator->count) {
+		if (animator->count == animator->size) {
+			if ((a = (PowerMateAnimation *)realloc(
+				animator->animations,
+				(animator->size ? animator->size * 2 : 4) * sizeof(PowerMateAnimation)
+			)) == NULL) {
+				errno = ENOMEM;
+				return -1;
+			}
+
+			animator->animations = a;
+			animator->size = animator->size ? animator->size * 2 : 4;
+		}
+
+		animator->count++;
+	}
+
+	animation = animator->animations + index;
+	animation->pm = pm;
+	animation->curve = curve;
+	animation->from = from;
+	animation->to = to;
+	animation->repeat = repeat;
+	animation->start = powermate_animator_clock();
+	animation->duration = (long long int)duration * 1000;
+	pm->animator = animator;
+	return 0;
+}
+
+
+/* Fades from the current brightness to the given one in duration
+milliseconds */
+
+int powermate_animator_fade(
+	PowerMateAnimator *animator,
+	PowerMate *pm,
+	unsigned char brightness,
+	unsigned int duration,
+	PowerMateCurve curve
+){
+	return powermate_animator_set(
+		animator, pm, curve,
+		pm->led.static_brightness, brightness, 0, duration);
+}
+
+
+/* Breathes between low and high, a full cycle every period milliseconds,
+until stopped */
+
+int powermate_animator_breathe(
+	PowerMateAnimator *animator,
+	PowerMate *pm,
+	unsigned char low,
+	unsigned char high,
+	unsigned int period
+){
+	if (!period) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return powermate_animator_set(animator, pm, POWERMATE_CURVE_BREATHE, low, high, 1, period);
+}
+
+
+/* Level meters: the brightness is written with the next frame, so the
+levels set in between cost nothing */
+
+int powermate_animator_set_level(PowerMateAnimator *animator, PowerMate *pm, unsigned char brightness)
+{
+	return powermate_animator_set(animator, pm, POWERMATE_CURVE_LINEAR, brightness, brightness, 0, 0);
+}
+
+
+/* The brightness is left as the last frame set it. Also called by
+powermate_destroy(). */
+
+int powermate_animator_stop(PowerMateAnimator *animator, PowerMate *pm)
+{
+	unsigned int index;
+
+	for (index = 0; index < animator->count; index++) if (animator->animations[index].pm == pm) {
+		animator->animations[index] = animator->animations[--animator->count];
+		pm->animator = NULL;
+		break;
+	}
+
+	if (!animator->count && animator->armed) return powermate_animator_arm(animator, 0);
+	return 0;
+}
+
+
+/* Computes a frame for every animation, writing only the brightness
+values which change. Called when the timerfd is readable. */
+
+int powermate_animator_dispatch(PowerMateAnimator *animator)
+{
+	PowerMateAnimation *animation;
+	unsigned long long int expirations;
+	long long int now = powermate_animator_clock(), elapsed;
+	unsigned int index, step;
+	int done, value;
+
+	if (read(animator->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return -1;
+	animator->frames++;
+
+	for (index = 0; index < animator->count;) {
+		animation = animator->animations + index;
+		elapsed = now - animation->start;
+		done = 0;
+
+		if (!animation->duration) {
+			step = STEPS - 1;
+			done = 1;
+
+		} else if (animation->repeat) {
+			step = (unsigned int)(elapsed % animation->duration * STEPS / animation->duration);
+
+		} else if (elapsed >= animation->duration) {
+			step = STEPS - 1;
+			done = 1;
+
+		} else step = (unsigned int)(elapsed * (STEPS - 1) / animation->duration);
+
+		value = animation->from + ((int)animation->to - animation->from) * animator->curves[animation->curve][step] / 255;
+
+		if (value == animation->pm->led.static_brightness) animator->skipped++;
+		else if (powermate_set_static_brightness(animation->pm, (unsigned char)value)) animator->failed++;
+		else animator->writes++;
+
+		if (done) {
+			animation->pm->animator = NULL;
+			animator->animations[index] = animator->animations[--animator->count];
+
+		} else index++;
+	}
+
+	if (!animator->count && animator->armed) return powermate_animator_arm(animator, 0);
+	return 0;
+}
+
+
+/* powermate-animator.c EOF */
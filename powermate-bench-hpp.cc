@@ -0,0 +1,147 @@
+/*
+	powermate-bench-hpp v1.0
+	C++ interface microbenchmark based in libpowermate.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda y Goñi
+	Distributed under the terms of the GNU General Public License version 2
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <powermate.hpp>
+#include <linux/input.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#define DEFAULT_EVENTS 10000000
+
+static long long int total_units;
+
+
+static double wall_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* C path: PowerMateHandlers, an indirect call per event */
+
+static int on_left(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	total_units -= units;
+	return 0;
+}
+
+
+static int on_right(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	total_units += units;
+	return 0;
+}
+
+
+/* C++ path: rotation only, button and LED events compile away */
+
+struct Rotation {
+	long long int units = 0;
+
+	void on_left(const powermate::Event &event) {units += event.units;}
+	void on_right(const powermate::Event &event) {units += event.units;}
+};
+
+
+static void make_frames(struct pm_event *events, unsigned int frames)
+{
+	unsigned int index;
+
+	memset(events, 0, frames * 2 * sizeof(struct pm_event));
+
+	for (index = 0; index < frames; index++) {
+		events[index * 2].type = EV_REL;
+		events[index * 2].code = REL_DIAL;
+		events[index * 2].data = (index % 3) ? 1 : -1;
+		events[index * 2 + 1].type = EV_SYN;
+		events[index * 2 + 1].code = SYN_REPORT;
+	}
+}
+
+
+/* Runs count rotation frames through an in-memory device, dispatched
+by dispatch(pm) until it runs out of events */
+
+template <class Dispatch> static double run(PowerMate *pm, unsigned long int count, Dispatch dispatch)
+{
+	static struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	unsigned long int done = 0, frames;
+	double t = 0, start;
+
+	make_frames(events, POWERMATE_MEMORY_EVENTS / 2);
+
+	while (done < count) {
+		frames = count - done > POWERMATE_MEMORY_EVENTS / 2 ? POWERMATE_MEMORY_EVENTS / 2 : count - done;
+		powermate_memory_inject(pm, events, (unsigned int)frames * 2);
+		done += frames;
+		start = wall_time();
+		dispatch(pm);
+		t += wall_time() - start;
+	}
+
+	return t;
+}
+
+
+int main(int argc, char **argv)
+{
+	PowerMateHandlers handlers = {on_left, on_right, NULL, NULL, NULL, NULL};
+	unsigned long int count = DEFAULT_EVENTS;
+	PowerMate *pm;
+	double t;
+
+	if (argc > 1 && (count = strtoul(argv[1], NULL, 10)) == 0) {
+		printf("error: invalid event count \"%s\"\n", argv[1]);
+		return EINVAL;
+	}
+
+	if ((pm = powermate_new_memory(&handlers)) == NULL) goto error;
+	t = run(pm, count, [](PowerMate *pm) {powermate_get_events(pm);});
+	printf(	"hpp.c_callbacks frames=%lu units=%lld ns_per_frame=%.2f\n", count, total_units, t * 1e9 / count);
+	powermate_destroy(pm);
+
+	if ((pm = powermate_new_memory(NULL)) == NULL) goto error;
+
+	{	powermate::Device<Rotation> device(pm);
+
+		t = run(pm, count, [&device](PowerMate *) {while (device.dispatch(0) > 0);});
+
+		printf(	"hpp.device frames=%lu units=%lld ns_per_frame=%.2f\n",
+			count, device.handler().units, t * 1e9 / count);
+	}
+
+	return 0;
+
+	error:
+	printf("error: benchmark failed, errno = %d (%s)\n", errno, strerror(errno));
+	return errno;
+}
+
+
+/* powermate-bench-hpp.cc EOF */
@@ -0,0 +1,1578 @@
+/*
+	powermate-bench v1.0
+	Non-interactive benchmark utility based in libpowermate.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda y Goñi
+	Distributed under the terms of the GNU General Public License version 2
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <powermate.h>
+#include <linux/input.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define VERSION "1.0"
+#define DEFAULT_EVENTS 1000000
+
+unsigned long long int dispatched;
+long long int injected, *latencies;
+unsigned long int latency_count;
+
+
+int on_rotate(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	dispatched++;
+	return 0;
+}
+
+
+int on_button(PowerMate *pm, void *data, unsigned long long int tesle)
+{
+	dispatched++;
+	return 0;
+}
+
+
+long long int clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long int)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Stores the time elapsed since the event was injected */
+
+int on_rotate_latency(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	latencies[latency_count++] = clock_ns() - injected;
+	dispatched++;
+	return 0;
+}
+
+
+double cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Forks a writer feeding count synthetic rotation events (each one
+followed by its SYN_REPORT, as the kernel does) into fd. */
+
+pid_t feed(int fd, unsigned long int count)
+{
+	struct input_event frames[64];
+	unsigned long int i, n;
+	size_t size, done;
+	pid_t pid;
+
+	if ((pid = fork())) return pid;
+
+	memset(frames, 0, sizeof(frames));
+	for (i = 0; i < 64; i += 2) {
+		frames[i].type = EV_REL;
+		frames[i].code = REL_DIAL;
+		frames[i].value = (i & 2) ? -1 : 1;
+		frames[i + 1].type = EV_SYN;
+		frames[i + 1].code = SYN_REPORT;
+	}
+
+	for (count *= 2; count; count -= n) {
+		n = count > 64 ? 64 : count;
+		size = n * sizeof(struct input_event);
+
+		for (done = 0; done < size;) {
+			ssize_t w = write(fd, (char *)frames + done, size - done);
+
+			if (w < 0) _exit(1);
+			done += w;
+		}
+	}
+
+	_exit(0);
+}
+
+
+/* The unbuffered loop of libpowermate 1.0, kept as reference:
+one read() and one gettimeofday() per event. */
+
+unsigned long long int legacy_get_events(int fd)
+{
+	struct input_event event;
+	struct timeval tv;
+	unsigned long long int reads = 0;
+
+	while (read(fd, &event, sizeof(struct input_event)) > 0) {
+		reads++;
+		gettimeofday(&tv, NULL);
+		if (event.type == EV_REL || event.type == EV_KEY) dispatched++;
+	}
+
+	return reads + 1;
+}
+
+
+void report(const char *name, unsigned long int count, unsigned long long int syscalls, double cpu)
+{
+	unsigned long long int events = count * 2;
+
+	printf(	"%s events=%llu dispatched=%llu syscalls_per_event=%.4f cpu_ns_per_event=%.1f\n",
+		name, events, dispatched,
+		(double)syscalls / events,
+		cpu * 1e9 / events
+	);
+}
+
+
+int bench_read(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	PowerMate *pm;
+	unsigned long long int reads;
+	int fds[2];
+	pid_t pid;
+	double t;
+
+	if (pipe(fds)) return -1;
+	pid = feed(fds[1], count);
+	close(fds[1]);
+	dispatched = 0;
+	t = cpu_time();
+	reads = legacy_get_events(fds[0]);
+	report("read.legacy", count, reads, cpu_time() - t);
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	if (pipe(fds)) return -1;
+	if ((pm = powermate_new_from_fd(fds[0], -1, &handlers)) == NULL) return -1;
+	pid = feed(fds[1], count);
+	close(fds[1]);
+	dispatched = 0;
+	t = cpu_time();
+	powermate_get_events(pm);
+	report("read.buffered", count, pm->reads, cpu_time() - t);
+	powermate_destroy(pm);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
+
+
+/* Writes frames rotation frames into fd without blocking the caller,
+the pipe must have room for them. */
+
+int fill(int fd, unsigned int frames)
+{
+	struct input_event e[2];
+
+	memset(e, 0, sizeof(e));
+	e[0].type = EV_REL;
+	e[0].code = REL_DIAL;
+	e[0].value = 1;
+	e[1].type = EV_SYN;
+	e[1].code = SYN_REPORT;
+
+	while (frames--) if (write(fd, e, sizeof(e)) != sizeof(e)) return -1;
+	return 0;
+}
+
+
+int bench_loop_devices(unsigned int devices, unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	PowerMateLoop *loop;
+	PowerMate **pms;
+	int *writers, fds[2];
+	unsigned int index, frames;
+	unsigned long long int reads = 0, target;
+	double t = 0, start;
+
+	/* Burst size per device, small enough to fit in a pipe */
+	frames = count / devices;
+	if (frames > 512) frames = 512;
+	if (!frames) frames = 1;
+
+	if ((loop = powermate_loop_new()) == NULL) return -1;
+	pms = (PowerMate **)calloc(devices, sizeof(PowerMate *));
+	writers = (int *)calloc(devices, sizeof(int));
+
+	for (index = 0; index < devices; index++) {
+		if (pipe(fds)) return -1;
+		writers[index] = fds[1];
+		if ((pms[index] = powermate_new_from_fd(fds[0], -1, &handlers)) == NULL) return -1;
+		if (powermate_loop_add(loop, pms[index])) return -1;
+	}
+
+	dispatched = 0;
+
+	for (target = 0; target < count; ) {
+		for (index = 0; index < devices; index++)
+			if (fill(writers[index], frames)) return -1;
+
+		target += (unsigned long long int)frames * devices;
+		start = cpu_time();
+		while (dispatched < target) if (powermate_loop_dispatch(loop, -1)) return -1;
+		t += cpu_time() - start;
+	}
+
+	for (index = 0; index < devices; index++) {
+		reads += pms[index]->reads;
+		powermate_loop_remove(loop, pms[index]);
+		powermate_destroy(pms[index]);
+		close(writers[index]);
+	}
+
+	printf(	"loop.devices_%u events=%llu dispatched=%llu wakeups_per_event=%.6f syscalls_per_event=%.4f cpu_ns_per_event=%.1f\n",
+		devices, target * 2, dispatched,
+		(double)loop->wakeups / (target * 2),
+		(double)(loop->wakeups + reads) / (target * 2),
+		t * 1e9 / (target * 2)
+	);
+
+	powermate_loop_destroy(loop);
+	free(pms);
+	free(writers);
+	return 0;
+}
+
+
+int bench_loop(unsigned long int count)
+{
+	unsigned int devices[] = {1, 16, 256, 1024}, index;
+
+	for (index = 0; index != 4; index++)
+		if (bench_loop_devices(devices[index], count)) return -1;
+	return 0;
+}
+
+
+/* Same workload on the epoll loop and on the io_uring backend: bursts
+of rotation on every device, then one LED write per device. System
+calls are counted for both, epoll_wait() + read() + write() against
+io_uring_enter(). */
+
+int bench_backend(unsigned int devices, unsigned long int count, int uring_backend)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	PowerMateLED led = {0, 255, 0, 0, 0};
+	PowerMateUring *uring = NULL;
+	PowerMateLoop *loop = NULL;
+	PowerMate **pms;
+	int *writers, fds[2], output;
+	unsigned int index, frames, round = 0;
+	unsigned long long int syscalls = 0, target;
+	double t = 0, start;
+
+	frames = count / devices;
+	if (frames > 512) frames = 512;
+	if (!frames) frames = 1;
+
+	if (uring_backend ? (uring = powermate_uring_new(devices)) == NULL : (loop = powermate_loop_new()) == NULL)
+		return -1;
+
+	pms = (PowerMate **)calloc(devices, sizeof(PowerMate *));
+	writers = (int *)calloc(devices, sizeof(int));
+
+	for (index = 0; index < devices; index++) {
+		if (pipe(fds) || (output = open("/dev/null", O_WRONLY)) == -1) return -1;
+		writers[index] = fds[1];
+		if ((pms[index] = powermate_new_from_fd(fds[0], output, &handlers)) == NULL) return -1;
+		if (uring_backend ? powermate_uring_add(uring, pms[index]) : powermate_loop_add(loop, pms[index]))
+			return -1;
+	}
+
+	dispatched = 0;
+
+	for (target = 0; target < count; round++) {
+		for (index = 0; index < devices; index++)
+			if (fill(writers[index], frames)) return -1;
+
+		target += (unsigned long long int)frames * devices;
+		start = cpu_time();
+
+		while (dispatched < target) if (uring_backend
+			? powermate_uring_dispatch(uring, -1)
+			: powermate_loop_dispatch(loop, -1)
+		) return -1;
+
+		led.static_brightness = (unsigned char)round;
+		for (index = 0; index < devices; index++) powermate_set_led(pms[index], &led);
+		t += cpu_time() - start;
+	}
+
+	if (uring_backend) {
+		powermate_uring_submit(uring);
+		syscalls = uring->enters;
+
+	} else {syscalls = loop->wakeups;
+
+		for (index = 0; index < devices; index++)
+			syscalls += pms[index]->reads + pms[index]->led_writer.writes;
+	}
+
+	printf(	"backend.%s_%u events=%llu dispatched=%llu led_writes=%llu syscalls_per_event=%.6f cpu_ns_per_event=%.1f\n",
+		uring_backend ? "uring" : "epoll", devices, target * 2, dispatched,
+		(unsigned long long int)round * devices,
+		(double)syscalls / (target * 2),
+		t * 1e9 / (target * 2)
+	);
+
+	for (index = 0; index < devices; index++) {
+		if (!uring_backend) powermate_loop_remove(loop, pms[index]);
+		powermate_destroy(pms[index]);
+		close(writers[index]);
+	}
+
+	if (uring_backend) powermate_uring_destroy(uring);
+	else powermate_loop_destroy(loop);
+	free(pms);
+	free(writers);
+	return 0;
+}
+
+
+int bench_uring(unsigned long int count)
+{
+	unsigned int devices[] = {1, 16, 256, 1024}, index;
+
+	for (index = 0; index != 4; index++)
+		if (	bench_backend(devices[index], count, 0) ||
+			bench_backend(devices[index], count, 1)
+		) return -1;
+
+	return 0;
+}
+
+
+double wall_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int write_file(const char *path, const char *value)
+{
+	FILE *file;
+
+	if ((file = fopen(path, "w")) == NULL) return -1;
+	fputs(value, file);
+	return fclose(file);
+}
+
+
+/* Builds a fake sysfs tree with nodes event nodes under root, only the
+last one being a PowerMate. */
+
+int make_sysfs(const char *root, unsigned int nodes)
+{
+	char path[PATH_MAX];
+	unsigned int index;
+
+	snprintf(path, sizeof(path), "%s/class", root);
+	if (mkdir(path, 0755)) return -1;
+	snprintf(path, sizeof(path), "%s/class/input", root);
+	if (mkdir(path, 0755)) return -1;
+
+	for (index = 0; index < nodes; index++) {
+		int last = index == nodes - 1;
+
+		snprintf(path, sizeof(path), "%s/class/input/event%u", root, index);
+		if (mkdir(path, 0755)) return -1;
+		strcat(path, "/device");
+		if (mkdir(path, 0755)) return -1;
+		snprintf(path, sizeof(path), "%s/class/input/event%u/device/name", root, index);
+		if (write_file(path, last ? "Griffin PowerMate\n" : "Generic Keyboard\n")) return -1;
+		snprintf(path, sizeof(path), "%s/class/input/event%u/device/id", root, index);
+		if (mkdir(path, 0755)) return -1;
+		strcat(path, "/vendor");
+		if (write_file(path, last ? "077d\n" : "046d\n")) return -1;
+		snprintf(path, sizeof(path), "%s/class/input/event%u/device/id/product", root, index);
+		if (write_file(path, last ? "0410\n" : "c31c\n")) return -1;
+	}
+
+	return 0;
+}
+
+
+unsigned int open_descriptors(void)
+{
+	unsigned int count = 0;
+	DIR *dir;
+
+	if ((dir = opendir("/proc/self/fd")) == NULL) return 0;
+	while (readdir(dir) != NULL) count++;
+	closedir(dir);
+	return count;
+}
+
+
+/* Descriptors and open time per device, and the events another reader
+of the node (the X server, libinput) gets while the knob is turned */
+
+int bench_open_mode(const char *name, PowerMateVirtual *knob, int flags, unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	struct input_event e[64];
+	unsigned long long int other = 0;
+	unsigned int index, descriptors;
+	ssize_t size;
+	PowerMate *pm;
+	double t;
+	int fd;
+
+	t = wall_time();
+
+	for (index = 0; index < 1000; index++) {
+		if ((pm = powermate_new_options(knob->device, flags, NULL)) == NULL) return -1;
+		powermate_destroy(pm);
+	}
+
+	t = wall_time() - t;
+	descriptors = open_descriptors();
+	if ((pm = powermate_new_options(knob->device, flags, &handlers)) == NULL) return -1;
+	descriptors = open_descriptors() - descriptors;
+
+	if ((fd = open(knob->device, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		powermate_destroy(pm);
+		return -1;
+	}
+
+	dispatched = 0;
+
+	for (index = 0; index < count; index++) {
+		powermate_virtual_rotate(knob, (index & 1) ? -1 : 1);
+
+		if (!(index & 63) || index == count - 1) {
+			while (powermate_get_events(pm) != -1);
+			while ((size = read(fd, e, sizeof(e))) > 0) other += (unsigned long long int)size / sizeof(*e);
+		}
+	}
+
+	printf(	"open.%s descriptors=%u us_per_open=%.1f events=%lu dispatched=%llu other_reader_events=%llu\n",
+		name, descriptors, t * 1e3, count, dispatched, other);
+
+	close(fd);
+	powermate_destroy(pm);
+	return 0;
+}
+
+
+int bench_open(unsigned long int count)
+{
+	PowerMateVirtual *knob;
+	int retval;
+
+	/* A virtual knob stands for the real one, uinput is needed */
+
+	if ((knob = powermate_virtual_new()) == NULL) {
+		printf("open.skipped reason=\"no uinput: %s\"\n", strerror(errno));
+		return 0;
+	}
+
+	usleep(100000);
+
+	retval =
+		bench_open_mode("two_fds", knob, POWERMATE_OPEN_NONBLOCK, count) ||
+		bench_open_mode("single_fd", knob, POWERMATE_OPEN_SINGLE_FD | POWERMATE_OPEN_NONBLOCK, count) ||
+		bench_open_mode("single_fd_grab", knob,
+			POWERMATE_OPEN_SINGLE_FD | POWERMATE_OPEN_NONBLOCK | POWERMATE_OPEN_GRAB, count)
+		? -1 : 0;
+
+	powermate_virtual_destroy(knob);
+	return retval;
+}
+
+
+int bench_discovery(unsigned long int count)
+{
+	unsigned int nodes[] = {16, 256, 1024, 4096}, index, round, rounds;
+	char root[] = "/tmp/powermate-bench-XXXXXX", command[64], **devices;
+	int found = 0;
+	double t;
+
+	for (index = 0; index != 4; index++) {
+		if (mkdtemp(root) == NULL || make_sysfs(root, nodes[index])) return -1;
+
+		/* Roughly the same amount of entries visited in every run */
+		if (!(rounds = count / 64 / nodes[index])) rounds = 1;
+		t = wall_time();
+
+		for (round = 0; round < rounds; round++) {
+			if ((found = search_powermate_devices_sysfs(root, NULL, &devices)) == -1) return -1;
+			while (found) free(devices[--found]);
+			free(devices);
+		}
+
+		t = (wall_time() - t) / rounds;
+		found = search_powermate_devices_sysfs(root, NULL, &devices);
+
+		printf(	"discovery.nodes_%u found=%d us_per_scan=%.1f ns_per_node=%.1f\n",
+			nodes[index], found, t * 1e6, t * 1e9 / nodes[index]);
+
+		while (found > 0) free(devices[--found]);
+		free(devices);
+
+		snprintf(command, sizeof(command), "rm -rf %s", root);
+		if (system(command)) return -1;
+		strcpy(root + strlen(root) - 6, "XXXXXX");
+	}
+
+	return 0;
+}
+
+
+/* Records count synthetic rotation frames, 4 ms apart, into path */
+
+int make_capture(const char *path, unsigned long int count)
+{
+	PowerMateCapture *capture;
+	struct pm_event e[2];
+	unsigned long int index;
+
+	if ((capture = powermate_capture_new(path)) == NULL) return -1;
+	memset(e, 0, sizeof(e));
+	e[0].type = EV_REL;
+	e[0].code = REL_DIAL;
+	e[1].type = EV_SYN;
+	e[1].code = SYN_REPORT;
+
+	for (index = 0; index < count; index++) {
+		e[0].a = e[1].a = 1000 + index / 250;
+		e[0].b = e[1].b = (index % 250) * 4000;
+		e[0].data = (index & 64) ? -1 : 1;
+		powermate_capture_event(capture, e);
+		powermate_capture_event(capture, e + 1);
+	}
+
+	return powermate_capture_destroy(capture);
+}
+
+
+/* A knob spun at 25, 62, 125 and 500 units per second, 256 frames at
+each speed, turning back every 1024 frames */
+
+int make_spin_capture(const char *path, unsigned long int count)
+{
+	static const long long int intervals[4] = {40000, 16000, 8000, 2000};
+	PowerMateCapture *capture;
+	struct pm_event e[2];
+	unsigned long int index;
+	long long int time = 1000000000;
+
+	if ((capture = powermate_capture_new(path)) == NULL) return -1;
+	memset(e, 0, sizeof(e));
+	e[0].type = EV_REL;
+	e[0].code = REL_DIAL;
+	e[1].type = EV_SYN;
+	e[1].code = SYN_REPORT;
+
+	for (index = 0; index < count; index++) {
+		time += intervals[(index / 256) % 4];
+		e[0].a = e[1].a = (long)(time / 1000000);
+		e[0].b = e[1].b = (long)(time % 1000000);
+		e[0].data = (index & 1024) ? -1 : 1;
+		powermate_capture_event(capture, e);
+		powermate_capture_event(capture, e + 1);
+	}
+
+	return powermate_capture_destroy(capture);
+}
+
+
+/* Gains of the 4/32/8x profile at the four speeds of the spin trace:
+40 ms is past slow (1x), 16 and 8 ms are on the ramp (5x and 7x) and
+2 ms is under fast (8x) */
+
+const unsigned int spin_gains[4] = {1, 5, 7, 8};
+
+long long int rotated;
+const unsigned int *expected_gains;
+unsigned long long int mismatched;
+
+
+/* Each event of the spin trace is a callback, the first one in every
+direction getting 1x as it has no previous interval */
+
+int on_rotate_units(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	unsigned int expected = expected_gains == NULL || !(dispatched % 1024)
+		? 1 : expected_gains[(dispatched / 256) % 4];
+
+	if (units != expected) mismatched++;
+	rotated += units;
+	dispatched++;
+	return 0;
+}
+
+
+/* Replays the trace with the given profile (gain 0 for none), twice to
+check that the result only depends on the event timestamps. Every
+callback must carry the units of the gains expected (1x if NULL). */
+
+int bench_acceleration_mode(
+	const char *path,
+	unsigned int fast,
+	unsigned int slow,
+	unsigned int gain,
+	const unsigned int *gains
+){
+	PowerMateHandlers handlers = {on_rotate_units, on_rotate_units, on_button, on_button, NULL, NULL};
+	long long int first = 0;
+	PowerMateReplay *replay;
+	PowerMate *pm;
+	unsigned int pass;
+	double t = 0;
+
+	expected_gains = gains;
+	mismatched = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		if (	(replay = powermate_replay_new(path, POWERMATE_REPLAY_FAST)) == NULL ||
+			(pm = powermate_new_replay(replay, &handlers)) == NULL ||
+			(gain && powermate_set_acceleration_profile(pm, fast, slow, gain))
+		) return -1;
+
+		rotated = 0;
+		dispatched = 0;
+		t = wall_time();
+		powermate_get_events(pm);
+		t = wall_time() - t;
+		if (!pass) first = rotated;
+
+		if (pass) printf(
+			"acceleration.%s events=%llu callbacks=%llu units=%lld gain=%.2f repeatable=%s mismatched=%llu ns_per_event=%.1f\n",
+			gain ? "profile" : "none", pm->events / 2, dispatched, rotated,
+			(double)rotated * 2 / pm->events, rotated == first ? "yes" : "no",
+			mismatched, t * 1e9 / (pm->events / 2));
+
+		if (dispatched * 2 != pm->events) mismatched++;
+		powermate_destroy(pm);
+	}
+
+	if (mismatched || rotated != first) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int bench_acceleration(unsigned long int count)
+{
+	char path[] = "/tmp/powermate-bench-XXXXXX";
+	int fd, retval;
+
+	if ((fd = mkstemp(path)) == -1) return -1;
+	close(fd);
+
+	retval =
+		make_spin_capture(path, count) ||
+		bench_acceleration_mode(path, 0, 0, 0, NULL) ||
+		bench_acceleration_mode(path, 4, 32, 8 * 256, spin_gains) ? -1 : 0;
+
+	unlink(path);
+	return retval;
+}
+
+
+int bench_replay(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	char path[] = "/tmp/powermate-bench-XXXXXX";
+	PowerMateReplay *replay;
+	PowerMate *pm;
+	struct stat file_stat;
+	int fd;
+	double t;
+
+	if ((fd = mkstemp(path)) == -1) return -1;
+	close(fd);
+
+	if (	make_capture(path, count) || stat(path, &file_stat) ||
+		(replay = powermate_replay_new(path, POWERMATE_REPLAY_FAST)) == NULL ||
+		(pm = powermate_new_replay(replay, &handlers)) == NULL
+	) {
+		unlink(path);
+		return -1;
+	}
+
+	dispatched = 0;
+	t = wall_time();
+	powermate_get_events(pm);
+	t = wall_time() - t;
+
+	printf(	"replay.fast events=%llu dispatched=%llu bytes_per_event=%.2f events_per_second=%.0f\n",
+		replay->records, dispatched,
+		(double)file_stat.st_size / replay->records,
+		replay->records / t
+	);
+
+	powermate_destroy(pm);
+	unlink(path);
+	return 0;
+}
+
+
+/* Fills events with frames rotation frames, as the kernel sends them */
+
+void make_frames(struct pm_event *events, unsigned int frames)
+{
+	unsigned int index;
+
+	memset(events, 0, frames * 2 * sizeof(struct pm_event));
+
+	for (index = 0; index < frames; index++) {
+		events[index * 2].type = EV_REL;
+		events[index * 2].code = REL_DIAL;
+		events[index * 2].data = (index & 1) ? -1 : 1;
+		events[index * 2 + 1].type = EV_SYN;
+		events[index * 2 + 1].code = SYN_REPORT;
+	}
+}
+
+
+/* Dispatch throughput of powermate_get_events() alone: the in-memory
+device is read without system calls */
+
+int bench_events(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	unsigned long long int total = 0;
+	unsigned int frames;
+	PowerMate *pm;
+	double t = 0, start;
+
+	if ((pm = powermate_new_memory(&handlers)) == NULL) return -1;
+	make_frames(events, POWERMATE_MEMORY_EVENTS / 2);
+	dispatched = 0;
+
+	while (total < count * 2) {
+		frames = count * 2 - total > POWERMATE_MEMORY_EVENTS
+			? POWERMATE_MEMORY_EVENTS / 2
+			: (unsigned int)(count * 2 - total) / 2;
+
+		if (!frames) break;
+		powermate_memory_inject(pm, events, frames * 2);
+		total += frames * 2;
+		start = wall_time();
+
+		if (powermate_get_events(pm) != -1 || errno != EAGAIN) {
+			powermate_destroy(pm);
+			return -1;
+		}
+
+		t += wall_time() - start;
+	}
+
+	printf(	"events.memory events=%llu dispatched=%llu reads=%llu events_per_second=%.0f ns_per_event=%.1f\n",
+		total, dispatched, pm->reads, total / t, t * 1e9 / total);
+
+	powermate_destroy(pm);
+	return 0;
+}
+
+
+/* The in-memory stream of the events benchmark consumed with the pull
+interface, a frame worth of events per call */
+
+int bench_poll(unsigned long int count)
+{
+	struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	PowerMateEvent decoded[POWERMATE_BUFFER_EVENTS];
+	unsigned long long int total = 0;
+	long long int units = 0;
+	unsigned int frames;
+	int index, n;
+	PowerMate *pm;
+	double t = 0, start;
+
+	if ((pm = powermate_new_memory(NULL)) == NULL) return -1;
+	make_frames(events, POWERMATE_MEMORY_EVENTS / 2);
+	dispatched = 0;
+
+	while (total < count * 2) {
+		frames = count * 2 - total > POWERMATE_MEMORY_EVENTS
+			? POWERMATE_MEMORY_EVENTS / 2
+			: (unsigned int)(count * 2 - total) / 2;
+
+		if (!frames) break;
+		powermate_memory_inject(pm, events, frames * 2);
+		total += frames * 2;
+		start = wall_time();
+
+		while ((n = powermate_poll_events(pm, decoded, POWERMATE_BUFFER_EVENTS, 0)) > 0)
+			for (index = 0; index < n; index++) {
+				units += decoded[index].units;
+				dispatched++;
+			}
+
+		if (n == -1) return -1;
+		t += wall_time() - start;
+	}
+
+	printf(	"poll.memory events=%llu decoded=%llu units=%lld events_per_second=%.0f ns_per_event=%.1f\n",
+		total, dispatched, units, total / t, t * 1e9 / total);
+
+	powermate_destroy(pm);
+	return 0;
+}
+
+
+int compare_latencies(const void *a, const void *b)
+{
+	long long int x = *(const long long int *)a, y = *(const long long int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+void report_latencies(const char *name)
+{
+	qsort(latencies, latency_count, sizeof(long long int), compare_latencies);
+
+	printf(	"%s samples=%lu p50_ns=%lld p90_ns=%lld p99_ns=%lld p999_ns=%lld max_ns=%lld\n",
+		name, latency_count,
+		latencies[latency_count * 50 / 100],
+		latencies[latency_count * 90 / 100],
+		latencies[latency_count * 99 / 100],
+		latencies[latency_count * 999 / 1000],
+		latencies[latency_count - 1]);
+}
+
+
+/* Time from the injection of a single frame to its rotation callback,
+through the in-memory device and through a pipe (one write() and one
+read() in the way, as with a real evdev node) */
+
+int bench_latency(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate_latency, on_rotate_latency, on_button, on_button, NULL, NULL};
+	struct pm_event events[2];
+	unsigned long int samples = count > 100000 ? 100000 : count, index;
+	PowerMate *pm;
+	int fds[2];
+
+	if ((latencies = (long long int *)malloc(samples * sizeof(long long int))) == NULL) return -1;
+	make_frames(events, 1);
+
+	if ((pm = powermate_new_memory(&handlers)) == NULL) return -1;
+	latency_count = 0;
+
+	for (index = 0; index < samples; index++) {
+		injected = clock_ns();
+		powermate_memory_inject(pm, events, 2);
+		if (powermate_get_events(pm) != -1 || errno != EAGAIN) return -1;
+	}
+
+	report_latencies("latency.memory");
+	powermate_destroy(pm);
+
+	if (pipe(fds)) return -1;
+	if ((pm = powermate_new_from_fd(fds[0], -1, &handlers)) == NULL) return -1;
+	pm->nonblock = 1;
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK)) return -1;
+	latency_count = 0;
+
+	for (index = 0; index < samples; index++) {
+		injected = clock_ns();
+		if (write(fds[1], events, sizeof(events)) != sizeof(events)) return -1;
+		if (powermate_get_events(pm) != -1 || errno != EAGAIN) return -1;
+	}
+
+	report_latencies("latency.pipe");
+	powermate_destroy(pm);
+	close(fds[1]);
+	free(latencies);
+	return 0;
+}
+
+
+/* powermate_set_led() cost with brightness changing on every call, so
+that nothing is suppressed: in-memory output (encoding and bookkeeping
+only) and /dev/null (plus one write() per call) */
+
+int bench_led_device(const char *name, PowerMate *pm, unsigned long int count)
+{
+	PowerMateLED led = {0, 255, 0, 0, 0};
+	unsigned long int index;
+	double t = wall_time();
+
+	for (index = 0; index < count; index++) {
+		led.static_brightness = (unsigned char)index;
+		if (powermate_set_led(pm, &led)) return -1;
+	}
+
+	t = wall_time() - t;
+
+	printf(	"led.%s calls=%lu writes=%llu writes_per_second=%.0f ns_per_call=%.1f\n",
+		name, count, pm->led_writer.writes, pm->led_writer.writes / t, t * 1e9 / count);
+
+	return 0;
+}
+
+
+int bench_led(unsigned long int count)
+{
+	PowerMate *pm;
+	int fds[2], output;
+
+	if ((pm = powermate_new_memory(NULL)) == NULL) return -1;
+	if (bench_led_device("memory", pm, count)) return -1;
+	powermate_destroy(pm);
+
+	if (pipe(fds)) return -1;
+	if ((output = open("/dev/null", O_WRONLY)) == -1) return -1;
+	if ((pm = powermate_new_from_fd(fds[0], output, NULL)) == NULL) return -1;
+	if (bench_led_device("devnull", pm, count)) return -1;
+	powermate_destroy(pm);
+	close(fds[1]);
+	return 0;
+}
+
+
+/* powermate_set_led_many() on 64 devices writing to /dev/null, first
+written in turn, then registered in a PowerMateUring where every call
+is one submission (plus the dispatch reaping the writes). System calls
+are write() against io_uring_enter(). */
+
+int bench_led_many_mode(PowerMateUring *uring, unsigned long int count)
+{
+	PowerMateLED led = {0, 255, 0, 0, 0};
+	PowerMate *pms[64];
+	int results[64], fds[2], writers[64], output;
+	unsigned long long int syscalls = 0;
+	unsigned long int calls, index;
+	double t;
+
+	for (index = 0; index < 64; index++) {
+		if (pipe(fds) || (output = open("/dev/null", O_WRONLY)) == -1) return -1;
+		writers[index] = fds[1];
+		if ((pms[index] = powermate_new_from_fd(fds[0], output, NULL)) == NULL) return -1;
+		if (uring != NULL && powermate_uring_add(uring, pms[index])) return -1;
+	}
+
+	if (uring != NULL) {
+		if (powermate_uring_submit(uring)) return -1;
+		syscalls = uring->enters;
+	}
+
+	calls = count / 64 ? count / 64 : 1;
+	t = wall_time();
+
+	for (index = 0; index < calls; index++) {
+		led.static_brightness = (unsigned char)index;
+		if (powermate_set_led_many(pms, 64, &led, 1, results)) return -1;
+		if (uring != NULL && powermate_uring_dispatch(uring, 0)) return -1;
+	}
+
+	t = wall_time() - t;
+
+	if (uring != NULL) syscalls = uring->enters - syscalls;
+	else for (index = 0; index < 64; index++) syscalls += pms[index]->led_writer.writes;
+
+	printf(	"led_many.%s_64 calls=%lu syscalls_per_call=%.2f ns_per_device=%.1f\n",
+		uring != NULL ? "uring" : "serial", calls, (double)syscalls / calls, t * 1e9 / (calls * 64));
+
+	for (index = 0; index < 64; index++) {
+		powermate_destroy(pms[index]);
+		close(writers[index]);
+	}
+
+	return 0;
+}
+
+
+int bench_led_many(unsigned long int count)
+{
+	PowerMateUring *uring;
+
+	if (bench_led_many_mode(NULL, count)) return -1;
+
+	if ((uring = powermate_uring_new(64)) == NULL) {
+		printf("led_many.uring_64 skipped reason=\"%s\"\n", strerror(errno));
+		return 0;
+	}
+
+	if (bench_led_many_mode(uring, count)) return -1;
+	return powermate_uring_destroy(uring);
+}
+
+
+/* Cost of the statistics: the same in-memory stream dispatched with
+them disabled and enabled, events stamped when injected */
+
+int bench_stats(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	PowerMateStats *stats;
+	struct timeval tv;
+	unsigned long long int total;
+	unsigned int frames, index;
+	PowerMate *pm;
+	double t[2], start;
+	int enabled;
+
+	if ((stats = (PowerMateStats *)malloc(sizeof(PowerMateStats))) == NULL) return -1;
+	make_frames(events, POWERMATE_MEMORY_EVENTS / 2);
+
+	for (enabled = 0; enabled != 2; enabled++) {
+		if ((pm = powermate_new_memory(&handlers)) == NULL) return -1;
+		if (enabled && powermate_set_stats(pm, 1)) return -1;
+		t[enabled] = 0;
+
+		for (total = 0; total + POWERMATE_MEMORY_EVENTS <= count * 2; total += frames * 2) {
+			frames = POWERMATE_MEMORY_EVENTS / 2;
+			gettimeofday(&tv, NULL);
+
+			for (index = 0; index < frames * 2; index++) {
+				events[index].a = tv.tv_sec;
+				events[index].b = tv.tv_usec;
+			}
+
+			powermate_memory_inject(pm, events, frames * 2);
+			start = wall_time();
+			if (powermate_get_events(pm) != -1 || errno != EAGAIN) return -1;
+			t[enabled] += wall_time() - start;
+		}
+
+		if (enabled) powermate_get_stats(pm, stats);
+		powermate_destroy(pm);
+	}
+
+	printf(	"stats.overhead events=%llu ns_per_event_disabled=%.1f ns_per_event_enabled=%.1f\n"
+		"stats.latency samples=%llu p50_ns=%llu p99_ns=%llu max_ns=%llu\n"
+		"stats.handler samples=%llu p50_ns=%llu p99_ns=%llu max_ns=%llu\n",
+		total,
+		t[0] * 1e9 / total, t[1] * 1e9 / total,
+		stats->latency.count,
+		powermate_histogram_percentile(&stats->latency, 50),
+		powermate_histogram_percentile(&stats->latency, 99),
+		stats->latency.max,
+		stats->handlers[POWERMATE_HANDLER_RIGHT].count,
+		powermate_histogram_percentile(&stats->handlers[POWERMATE_HANDLER_RIGHT], 50),
+		powermate_histogram_percentile(&stats->handlers[POWERMATE_HANDLER_RIGHT], 99),
+		stats->handlers[POWERMATE_HANDLER_RIGHT].max);
+
+	free(stats);
+	return 0;
+}
+
+
+unsigned long long int received_units;
+unsigned int handler_delay;
+
+
+/* Rotation handler blocking for handler_delay microseconds every 256
+events, as one calling into a slow API would */
+
+int on_rotate_slow(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	struct timespec ts = {0, handler_delay * 1000L};
+
+	received_units += units;
+	if (!(++dispatched & 255) && handler_delay) nanosleep(&ts, NULL);
+	return 0;
+}
+
+
+/* Pipe fed by a writer process, dispatched straight from the pipe and
+through the reader thread. With a slow handler the ring overflows and
+the folded rotation must still add up to what was sent. */
+
+int bench_reader_mode(const char *name, unsigned long int count, unsigned int delay, int threaded)
+{
+	PowerMateHandlers handlers = {on_rotate_slow, on_rotate_slow, on_button, on_button, NULL, NULL};
+	unsigned long long int overflows = 0, dropped = 0;
+	PowerMate *pm;
+	int fds[2];
+	pid_t pid;
+	double t;
+
+	if (pipe(fds)) return -1;
+	if ((pm = powermate_new_from_fd(fds[0], -1, &handlers)) == NULL) return -1;
+	if (threaded && powermate_start_reader(pm)) return -1;
+
+	/* Only right turns, so units received can be compared */
+	pid = fork();
+
+	if (!pid) {
+		struct pm_event events[128];
+
+		make_frames(events, 64);
+		for (count *= 2; count; count -= 128) {
+			unsigned int index;
+
+			for (index = 0; index < 128; index += 2) events[index].data = 1;
+			if (write(fds[1], events, sizeof(events)) != sizeof(events)) _exit(1);
+			if (count < 128) break;
+		}
+
+		_exit(0);
+	}
+
+	close(fds[1]);
+	dispatched = received_units = 0;
+	handler_delay = delay;
+	t = wall_time();
+	if (powermate_get_events(pm) != -1 || errno != ENODEV) return -1;
+	t = wall_time() - t;
+
+	if (threaded) {
+		overflows = pm->reader->overflows;
+		dropped = pm->reader->dropped;
+	}
+
+	printf(	"reader.%s events=%lu units_received=%llu overflows=%llu dropped=%llu events_per_second=%.0f\n",
+		name, count * 2, received_units, overflows, dropped, count * 2 / t);
+
+	powermate_destroy(pm);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
+
+
+int bench_reader(unsigned long int count)
+{
+	count = (count + 63) / 64 * 64;
+
+	return	bench_reader_mode("direct", count, 0, 0) ||
+		bench_reader_mode("thread", count, 0, 1) ||
+		bench_reader_mode("direct_slow", count, 2000, 0) ||
+		bench_reader_mode("thread_slow", count, 2000, 1) ? -1 : 0;
+}
+
+
+/* 256 in-memory devices animated by one PowerMateAnimator at 100 frames
+per second for one second: fades, breathing, and level meters updated
+by the application at 1 kHz. Writes are counted against the frames. */
+
+int bench_animator(unsigned long int count)
+{
+	PowerMateAnimator *animator;
+	PowerMate *pms[256];
+	struct pollfd pfd;
+	unsigned long long int writes = 0, levels = 0;
+	unsigned int index;
+	double start, cpu = 0, t;
+
+	if ((animator = powermate_animator_new(100)) == NULL) return -1;
+
+	for (index = 0; index < 256; index++) {
+		if ((pms[index] = powermate_new_memory(NULL)) == NULL) return -1;
+
+		if (	index % 3 == 0 ? powermate_animator_fade(animator, pms[index], 255, 1000, POWERMATE_CURVE_EASE) :
+			index % 3 == 1 ? powermate_animator_breathe(animator, pms[index], 0, 255, 500) :
+			powermate_animator_set_level(animator, pms[index], 0)
+		) return -1;
+	}
+
+	pfd.fd = animator->fd;
+	pfd.events = POLLIN;
+	start = wall_time();
+
+	while (wall_time() - start < 1) {
+		if (poll(&pfd, 1, 1) == 1) {
+			t = cpu_time();
+			if (powermate_animator_dispatch(animator)) return -1;
+			cpu += cpu_time() - t;
+		}
+
+		/* Meters follow a fake signal */
+
+		for (index = 2; index < 256; index += 3, levels++)
+			powermate_animator_set_level(animator, pms[index], (unsigned char)((levels * 7) >> 4));
+	}
+
+	for (index = 0; index < 256; index++)
+		writes += pms[index]->led_writer.writes;
+
+	printf(	"animator.devices_256 frames=%llu level_updates=%llu writes=%llu skipped=%llu writes_per_device_frame=%.3f cpu_us_per_frame=%.1f\n",
+		animator->frames, levels, writes, animator->skipped,
+		(double)writes / (animator->frames * 256), cpu * 1e6 / animator->frames);
+
+	/* The animator goes first: its devices must be detached from it */
+
+	powermate_animator_destroy(animator);
+
+	for (index = 0; index < 256; index++) {
+		if (pms[index]->animator != NULL) {
+			fprintf(stderr, "animator: device %u still attached after destroy\n", index);
+			errno = EPROTO;
+			return -1;
+		}
+
+		powermate_destroy(pms[index]);
+	}
+
+	return 0;
+}
+
+
+/* A click and a turn while pressed, 400 ms apart in event time so that
+every click is delivered by the next press once its window is over */
+
+int bench_gestures_mode(
+	const char *name,
+	PowerMateHandlers *handlers,
+	PowerMateGestureHandlers *gestures,
+	unsigned long int count
+){
+	static const struct {unsigned short type, code; int value;} pattern[8] = {
+		{EV_KEY, BTN_0, 1}, {EV_KEY, BTN_0, 0}, {EV_REL, REL_DIAL, 1}, {EV_REL, REL_DIAL, -1},
+		{EV_KEY, BTN_0, 1}, {EV_REL, REL_DIAL, 1}, {EV_REL, REL_DIAL, -1}, {EV_KEY, BTN_0, 0}
+	};
+
+	struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	unsigned long long int total = 0, frame;
+	unsigned int index, size;
+	long long int time;
+	PowerMate *pm;
+	double t = 0, start;
+
+	if ((pm = powermate_new_memory(handlers)) == NULL) return -1;
+	if (gestures != NULL) powermate_set_gesture_handlers(pm, gestures);
+	memset(events, 0, sizeof(events));
+	dispatched = 0;
+
+	while (total < count) {
+		size = count - total > POWERMATE_MEMORY_EVENTS
+			? POWERMATE_MEMORY_EVENTS
+			: (unsigned int)(count - total) & ~1U;
+
+		if (!size) break;
+
+		for (index = 0; index < size; index += 2) {
+			frame = (total + index) / 2;
+			time = (long long int)(frame / 4) * 400000 + (long long int)(frame % 4) * 10000;
+			events[index].a = events[index + 1].a = (long)(time / 1000000);
+			events[index].b = events[index + 1].b = (long)(time % 1000000);
+			events[index].type = (short)pattern[frame % 8].type;
+			events[index].code = (short)pattern[frame % 8].code;
+			events[index].data = (unsigned int)pattern[frame % 8].value;
+			events[index + 1].type = EV_SYN;
+			events[index + 1].code = SYN_REPORT;
+		}
+
+		powermate_memory_inject(pm, events, size);
+		total += size;
+		start = wall_time();
+
+		if (powermate_get_events(pm) != -1 || errno != EAGAIN) {
+			powermate_destroy(pm);
+			return -1;
+		}
+
+		t += wall_time() - start;
+	}
+
+	printf(	"gestures.%s events=%llu dispatched=%llu ns_per_event=%.1f\n",
+		name, total, dispatched, t * 1e9 / total);
+
+	powermate_destroy(pm);
+	return 0;
+}
+
+
+int bench_gestures(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	PowerMateGestureHandlers gestures = {on_button, on_button, on_button, on_rotate, on_rotate};
+
+	return	bench_gestures_mode("off", &handlers, NULL, count) ||
+		bench_gestures_mode("on", &handlers, &gestures, count) ? -1 : 0;
+}
+
+
+/* Frames of a knob turned, pressed now and then and pulsing its LED
+(which echoes every word set), for an application handling rotation
+only. Each frame finding the device empty is a wakeup. */
+
+int bench_filter_mode(const char *name, int enabled, unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, NULL, NULL, NULL, NULL};
+	struct pm_event frame[2];
+	struct pollfd pfd;
+	unsigned long long int wakeups = 0;
+	unsigned long int index;
+	PowerMate *pm;
+	double t;
+
+	if ((pm = powermate_new_memory(&handlers)) == NULL || powermate_set_event_filter(pm, enabled)) return -1;
+	memset(frame, 0, sizeof(frame));
+	frame[1].type = EV_SYN;
+	frame[1].code = SYN_REPORT;
+	pfd.fd = pm->input;
+	pfd.events = POLLIN;
+	dispatched = 0;
+	t = wall_time();
+
+	for (index = 0; index < count; index++) {
+		switch (index % 4) {
+			case 0: case 2:
+				frame[0].type = EV_REL;
+				frame[0].code = REL_DIAL;
+				frame[0].data = 1;
+				break;
+
+			case 1:
+				frame[0].type = EV_MSC;
+				frame[0].code = MSC_PULSELED;
+				frame[0].data = (unsigned int)index & 0xFF;
+				break;
+
+			default:
+				frame[0].type = EV_KEY;
+				frame[0].code = BTN_0;
+				frame[0].data = (index / 4) & 1;
+		}
+
+		powermate_memory_inject(pm, frame, 2);
+
+		if (poll(&pfd, 1, 0) == 1) {
+			wakeups++;
+			powermate_get_events(pm);
+		}
+	}
+
+	t = wall_time() - t;
+
+	printf(	"filter.%s frames=%lu wakeups=%llu avoided=%llu dispatched=%llu ns_per_frame=%.1f\n",
+		name, count, wakeups, pm->filter.avoided, dispatched, t * 1e9 / count);
+
+	powermate_destroy(pm);
+	return 0;
+}
+
+
+int bench_filter(unsigned long int count)
+{
+	return bench_filter_mode("off", 0, count) || bench_filter_mode("on", 1, count) ? -1 : 0;
+}
+
+
+/* Publisher side of the shared state benchmark: rotation frames
+dispatched as fast as possible, each one a state change */
+
+volatile int publishing;
+
+void *bench_publish_writer(void *argument)
+{
+	PowerMate *pm = (PowerMate *)argument;
+	struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	unsigned int index;
+
+	make_frames(events, POWERMATE_MEMORY_EVENTS / 2);
+	for (index = 0; index < POWERMATE_MEMORY_EVENTS; index += 2) events[index].data = 1;
+
+	while (publishing) {
+		powermate_memory_inject(pm, events, POWERMATE_MEMORY_EVENTS);
+		powermate_get_events(pm);
+	}
+
+	return NULL;
+}
+
+
+/* Cost of publishing per event, then samples taken by a reader while
+the publisher updates the slot from another thread. Only rotation is
+published, so a consistent sample has as many events as units. */
+
+int bench_publish(unsigned long int count)
+{
+	PowerMateHandlers handlers = {on_rotate, on_rotate, on_button, on_button, NULL, NULL};
+	char path[64];
+	struct pm_event events[POWERMATE_MEMORY_EVENTS];
+	unsigned long long int total, retries = 0, torn = 0;
+	const PowerMateShared *shared;
+	PowerMatePublisher *publisher;
+	PowerMateSample sample;
+	pthread_t thread;
+	PowerMate *pm;
+	unsigned long int index;
+	unsigned int pass;
+	double t, times[2];
+
+	snprintf(path, sizeof(path), "/dev/shm/powermate-bench-%d", (int)getpid());
+
+	if (	(publisher = powermate_publisher_new(path, 4)) == NULL ||
+		(shared = powermate_shared_open(path)) == NULL
+	) return -1;
+
+	make_frames(events, POWERMATE_MEMORY_EVENTS / 2);
+
+	for (pass = 0; pass < 2; pass++) {
+		if (	(pm = powermate_new_memory(&handlers)) == NULL ||
+			(pass && powermate_publish(publisher, pm, 0))
+		) return -1;
+
+		for (total = 0, t = 0; total < count * 2; total += POWERMATE_MEMORY_EVENTS) {
+			powermate_memory_inject(pm, events, POWERMATE_MEMORY_EVENTS);
+			t -= wall_time();
+			powermate_get_events(pm);
+			t += wall_time();
+		}
+
+		times[pass] = t * 1e9 / total;
+		powermate_destroy(pm);
+	}
+
+	if ((pm = powermate_new_memory(NULL)) == NULL || powermate_publish(publisher, pm, 0)) return -1;
+	publishing = 1;
+
+	if ((errno = pthread_create(&thread, NULL, bench_publish_writer, pm))) return -1;
+	do powermate_shared_read(shared, 0, &sample); while (!sample.events);
+	t = wall_time();
+
+	for (index = 0; index < count; index++) {
+		powermate_shared_read(shared, 0, &sample);
+		retries += sample.retries;
+		if ((unsigned long long int)sample.position != sample.events) torn++;
+	}
+
+	t = wall_time() - t;
+	publishing = 0;
+	pthread_join(thread, NULL);
+
+	printf(	"publish.cost ns_per_event_unpublished=%.1f ns_per_event_published=%.1f\n"
+		"publish.readers samples=%lu ns_per_sample=%.1f retries=%llu torn=%llu published_events=%llu\n",
+		times[0], times[1], count, t * 1e9 / count, retries, torn, sample.events);
+
+	/* The segment stays while a device is published in it */
+
+	if (powermate_publisher_destroy(publisher) != -1 || errno != EBUSY) {
+		fprintf(stderr, "publish: publisher destroyed with a device published\n");
+		errno = EPROTO;
+		return -1;
+	}
+
+	powermate_destroy(pm);
+	powermate_shared_close(shared);
+	return powermate_publisher_destroy(publisher);
+}
+
+
+int bench_all(unsigned long int count)
+{
+	return	bench_events(count) || bench_poll(count) || bench_latency(count) || bench_led(count) || bench_led_many(count) || bench_stats(count) ||
+		bench_reader(count) || bench_animator(count) || bench_gestures(count) || bench_filter(count) || bench_publish(count) ||
+		bench_read(count) || bench_loop(count) || bench_uring(count) || bench_discovery(count) ||
+		bench_replay(count) || bench_acceleration(count) || bench_open(count) ? -1 : 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *help =
+		"usage: powermate-bench <BENCHMARK> [EVENTS]\n"
+		"\n"
+		"  all		every benchmark below, one after the other\n"
+		"  events	get_events() dispatch throughput on an in-memory device\n"
+		"  poll		the same stream pulled with powermate_poll_events()\n"
+		"  latency	injection to callback latency percentiles\n"
+		"  led		set_led() writes per second\n"
+		"  led_many	set_led_many() on 64 devices, in turn and through io_uring\n"
+		"  stats		cost of the per-device statistics\n"
+		"  reader	dispatch through the reader thread, with and without a slow handler\n"
+		"  animator	LED animations of 256 devices from one timerfd\n"
+		"  gestures	dispatch cost of the gesture recognizer\n"
+		"  filter	wakeups saved by the kernel event filter, rotation handlers only\n"
+		"  publish	shared state publishing cost and seqlock samples under updates\n"
+		"  read		batched event reads against the one read() per event loop\n"
+		"  loop		epoll loop scaling with 1, 16, 256 and 1024 devices\n"
+		"  uring		epoll loop against the io_uring backend, with LED writes\n"
+		"  discovery	sysfs device discovery over 16 to 4096 fake nodes\n"
+		"  open		descriptors, open time and other readers woken, with and without grab\n"
+		"  replay	capture replay speed and trace size\n"
+		"  acceleration	rotation acceleration over a replayed spin trace\n"
+		"  -v --version	display program version and copyright\n"
+		"  -h --help	display this information";
+
+	unsigned long int count = DEFAULT_EVENTS;
+	int retval;
+
+	if (argc < 2 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+		puts(help);
+		return 0;
+	}
+
+	if (!strcmp(argv[1], "-v") || !strcmp(argv[1], "--version")) {
+		puts(	"powermate-bench v" VERSION " - libpowermate benchmark utility\n"
+			"Distributed under the terms of the GNU General Public License version 2");
+		return 0;
+	}
+
+	if (argc > 2 && (count = strtoul(argv[2], NULL, 10)) == 0) {
+		printf("error: invalid event count \"%s\"\n", argv[2]);
+		return EINVAL;
+	}
+
+	if (!strcmp(argv[1], "all")) retval = bench_all(count);
+	else if (!strcmp(argv[1], "events")) retval = bench_events(count);
+	else if (!strcmp(argv[1], "poll")) retval = bench_poll(count);
+	else if (!strcmp(argv[1], "latency")) retval = bench_latency(count);
+	else if (!strcmp(argv[1], "led")) retval = bench_led(count);
+	else if (!strcmp(argv[1], "led_many")) retval = bench_led_many(count);
+	else if (!strcmp(argv[1], "stats")) retval = bench_stats(count);
+	else if (!strcmp(argv[1], "reader")) retval = bench_reader(count);
+	else if (!strcmp(argv[1], "animator")) retval = bench_animator(count);
+	else if (!strcmp(argv[1], "gestures")) retval = bench_gestures(count);
+	else if (!strcmp(argv[1], "filter")) retval = bench_filter(count);
+	else if (!strcmp(argv[1], "publish")) retval = bench_publish(count);
+	else if (!strcmp(argv[1], "read")) retval = bench_read(count);
+	else if (!strcmp(argv[1], "loop")) retval = bench_loop(count);
+	else if (!strcmp(argv[1], "uring")) retval = bench_uring(count);
+	else if (!strcmp(argv[1], "discovery")) retval = bench_discovery(count);
+	else if (!strcmp(argv[1], "open")) retval = bench_open(count);
+	else if (!strcmp(argv[1], "replay")) retval = bench_replay(count);
+	else if (!strcmp(argv[1], "acceleration")) retval = bench_acceleration(count);
+
+	else {	printf("error: unknown benchmark \"%s\"\n", argv[1]);
+		return EINVAL;
+	}
+
+	if (retval) {
+		printf("error: benchmark failed, errno = %d (%s)\n", errno, strerror(errno));
+		return errno;
+	}
+
+	return 0;
+}
+
+
+/* powermate-bench.c EOF */
@@ -0,0 +1,383 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "powermate.h"
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*	Capture file format:
+
+	header:	"PMCAP" 0x01 0x00 0x00		(magic, version 1, reserved)
+	record:	varint	time delta		(zigzag, microseconds since the previous record,
+						 the first one counts from 0)
+		varint	type
+		varint	code
+		varint	value			(zigzag)
+
+	Varints are LEB128: 7 bits per byte, least significant first, the
+	high bit set in every byte but the last. A rotation record usually
+	takes 5 bytes instead of the 24 of a struct pm_event on 64 bits.
+	There is no index nor length field, so files can be appended to and
+	replayed straight from a read-only mapping.					*/
+
+
+#define POWERMATE_CAPTURE_MAGIC		"PMCAP\1\0\0"
+#define POWERMATE_CAPTURE_HEADER_SIZE	8
+#define POWERMATE_CAPTURE_RECORD_MAX	40
+
+
+static unsigned char *powermate_put_varint(unsigned char *p, unsigned long long int value)
+{
+	while (value > 0x7F) {
+		*p++ = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+
+/* Returns NULL on truncated or oversized varints */
+
+static const unsigned char *powermate_get_varint(
+	const unsigned char *p,
+	const unsigned char *end,
+	unsigned long long int *value
+){
+	unsigned int shift = 0;
+
+	*value = 0;
+
+	while (p != end && shift < 64) {
+		*value |= (unsigned long long int)(*p & 0x7F) << shift;
+		if (!(*p++ & 0x80)) return p;
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+
+#define ZIGZAG(v)   (((unsigned long long int)(v) << 1) ^ (unsigned long long int)((v) >> 63))
+#define UNZIGZAG(v) ((long long int)((v) >> 1) ^ -(long long int)((v) & 1))
+
+
+PowerMateCapture *powermate_capture_new(const char *path)
+{
+	PowerMateCapture *capture = (PowerMateCapture *)calloc(1, sizeof(PowerMateCapture));
+
+	if (capture == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((capture->buffer = (unsigned char *)malloc(POWERMATE_CAPTURE_BUFFER_SIZE)) == NULL) {
+		free(capture);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+		int error = errno;
+
+		free(capture->buffer);
+		free(capture);
+		errno = error;
+		return NULL;
+	}
+
+	memcpy(capture->buffer, POWERMATE_CAPTURE_MAGIC, POWERMATE_CAPTURE_HEADER_SIZE);
+	capture->size = POWERMATE_CAPTURE_HEADER_SIZE;
+	return capture;
+}
+
+
+int powermate_capture_flush(PowerMateCapture *capture)
+{
+	size_t done = 0;
+	ssize_t size;
+
+	while (done < capture->size) {
+		if ((size = write(capture->fd, capture->buffer + done, capture->size - done)) < 0) {
+			if (errno == EINTR) continue;
+			if (!capture->error) capture->error = errno;
+			capture->size = 0;
+			return -1;
+		}
+
+		done += (size_t)size;
+	}
+
+	capture->size = 0;
+	return 0;
+}
+
+
+int powermate_capture_destroy(PowerMateCapture *capture)
+{
+	int retval = powermate_capture_flush(capture);
+
+	if (close(capture->fd) && !retval) retval = -1;
+	free(capture->buffer);
+	free(capture);
+	return retval;
+}
+
+
+int powermate_capture_event(PowerMateCapture *capture, struct pm_event *event)
+{
+	long long int time = (long long int)event->a * 1000000 + event->b;
+	unsigned char *p;
+
+	if (	POWERMATE_CAPTURE_BUFFER_SIZE - capture->size < POWERMATE_CAPTURE_RECORD_MAX
+		&& powermate_capture_flush(capture)
+	) return -1;
+
+	p = capture->buffer + capture->size;
+	p = powermate_put_varint(p, ZIGZAG(time - capture->time));
+	p = powermate_put_varint(p, (unsigned short)event->type);
+	p = powermate_put_varint(p, (unsigned short)event->code);
+	p = powermate_put_varint(p, ZIGZAG((long long int)(int)event->data));
+	capture->size = (size_t)(p - capture->buffer);
+	capture->time = time;
+	capture->records++;
+	return 0;
+}
+
+
+PowerMateReplay *powermate_replay_new(const char *path, PowerMateReplayPacing pacing)
+{
+	PowerMateReplay *replay;
+	struct stat file_stat;
+	void *data;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return NULL;
+
+	if (fstat(fd, &file_stat)) {
+		close(fd);
+		return NULL;
+	}
+
+	if (	file_stat.st_size < POWERMATE_CAPTURE_HEADER_SIZE ||
+		(data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED
+	) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	close(fd);
+
+	if (memcmp(data, POWERMATE_CAPTURE_MAGIC, 6)) {
+		munmap(data, (size_t)file_stat.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((replay = (PowerMateReplay *)calloc(1, sizeof(PowerMateReplay))) == NULL) {
+		munmap(data, (size_t)file_stat.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* Records are decoded straight from the mapping, sequential
+	access lets the kernel read ahead large traces */
+
+	madvise(data, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+	replay->data = (const unsigned char *)data;
+	replay->size = (size_t)file_stat.st_size;
+	replay->pacing = pacing;
+	powermate_replay_rewind(replay);
+	return replay;
+}
+
+
+int powermate_replay_destroy(PowerMateReplay *replay)
+{
+	munmap((void *)replay->data, replay->size);
+	free(replay);
+	return 0;
+}
+
+
+int powermate_replay_rewind(PowerMateReplay *replay)
+{
+	replay->offset = POWERMATE_CAPTURE_HEADER_SIZE;
+	replay->time = 0;
+	replay->ready = 0;
+	replay->records = 0;
+	return 0;
+}
+
+
+/* Decodes the next record into replay->next. Returns 0 at the end of
+the trace and -1 if it is corrupted. */
+
+static int powermate_replay_decode(PowerMateReplay *replay)
+{
+	const unsigned char *p = replay->data + replay->offset, *end = replay->data + replay->size;
+	unsigned long long int delta, type, code, value;
+
+	if (p == end) return 0;
+
+	if (	(p = powermate_get_varint(p, end, &delta)) == NULL ||
+		(p = powermate_get_varint(p, end, &type)) == NULL ||
+		(p = powermate_get_varint(p, end, &code)) == NULL ||
+		(p = powermate_get_varint(p, end, &value)) == NULL
+	) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	replay->offset = (size_t)(p - replay->data);
+	replay->time += UNZIGZAG(delta);
+	replay->next.a = (long)(replay->time / 1000000);
+	replay->next.b = (long)(replay->time % 1000000);
+	replay->next.type = (short)type;
+	replay->next.code = (short)code;
+	replay->next.data = (unsigned int)UNZIGZAG(value);
+
+	if (!replay->records && !replay->ready) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		replay->start = (long long int)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		replay->first = replay->time;
+	}
+
+	replay->ready = 1;
+	return 1;
+}
+
+
+/* Replay transport, its open() argument is the PowerMateReplay */
+
+static int powermate_replay_open(PowerMate *pm, void *argument)
+{
+	pm->transport_data = argument;
+	return 0;
+}
+
+
+static ssize_t powermate_replay_transport_read(PowerMate *pm, void *buffer, size_t size)
+{
+	return powermate_replay_read((PowerMateReplay *)pm->transport_data, buffer, size);
+}
+
+
+/* There is no output, LED writes fail with EBADF */
+
+static ssize_t powermate_replay_write(PowerMate *pm, const void *buffer, size_t size)
+{
+	(void)pm;
+	(void)buffer;
+	(void)size;
+	errno = EBADF;
+	return -1;
+}
+
+
+static const char *powermate_replay_identify(PowerMate *pm)
+{
+	(void)pm;
+	return "Griffin PowerMate";
+}
+
+
+static int powermate_replay_close(PowerMate *pm)
+{
+	return powermate_replay_destroy((PowerMateReplay *)pm->transport_data);
+}
+
+
+static const PowerMateTransport powermate_replay_transport = {
+	powermate_replay_open,
+	powermate_replay_transport_read,
+	powermate_replay_write,
+	powermate_replay_identify,
+	powermate_replay_close
+};
+
+
+/* Creates a device fed by a capture replay, which is destroyed along
+with it */
+
+PowerMate *powermate_new_replay(PowerMateReplay *replay, PowerMateHandlers *handlers)
+{
+	return powermate_new_transport(&powermate_replay_transport, replay, handlers);
+}
+
+
+/* Works like read() on an evdev node: fills buffer with whole records,
+in real-time pacing only with those already due, sleeping if none is.
+Returns 0 at the end of the trace. */
+
+ssize_t powermate_replay_read(PowerMateReplay *replay, void *buffer, size_t size)
+{
+	size_t done = 0;
+	int retval;
+
+	while (size - done >= sizeof(struct pm_event)) {
+		if (!replay->ready && (retval = powermate_replay_decode(replay)) <= 0) {
+			if (retval == -1 && !done) return -1;
+			break;
+		}
+
+		if (replay->pacing == POWERMATE_REPLAY_REALTIME) {
+			struct timespec ts;
+			long long int wait;
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+
+			wait =	replay->start + (replay->time - replay->first)
+				- ((long long int)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+
+			if (wait > 0) {
+				if (done) break;
+				ts.tv_sec = (time_t)(wait / 1000000);
+				ts.tv_nsec = (long)(wait % 1000000) * 1000;
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		memcpy((char *)buffer + done, &replay->next, sizeof(struct pm_event));
+		done += sizeof(struct pm_event);
+		replay->ready = 0;
+		replay->records++;
+	}
+
+	return (ssize_t)done;
+}
+
+
+/* powermate-capture.c EOF */
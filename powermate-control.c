@@ -22,13 +22,35 @@
 
 
 #include <powermate.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define VERSION "1.0"
 #define COMMANDS 10
 
+/* Daemon limits */
+#define DAEMON_DEVICES	64
+#define DAEMON_CLIENTS	64
+#define CLIENT_QUEUE	65536	/* bytes a client may fall behind before being dropped */
+#define CLIENT_INPUT	4096	/* longest command batch kept while incomplete */
+#define FRAME_SIZE	16384	/* events gathered before being sent to the subscribers */
+
+/* Batch mode */
+#define BATCH_THREADS	16	/* devices opened at the same time */
+#define BATCH_ARGUMENTS	32	/* words per line */
+
 enum {	BRIGHTNESS,
 	MODE,
 	SPEED,
@@ -37,6 +59,15 @@ enum {	BRIGHTNESS,
 };
 
 
+const char *commands[] = {
+	"-b", "--brightness",
+	"-m", "--mode",
+	"-s", "--speed",
+	"-n", "--pulse-awake",
+	"-f", "--pulse-asleep"
+};
+
+
 int get_integer(char *string)
 {
 	char *s = string;
@@ -46,16 +77,781 @@ int get_integer(char *string)
 }
 
 
+/* Applies count option and value words to led. Errors are reported
+prefixed by where (the batch line). */
+
+int parse_options(char **args, int count, PowerMateLED *led, const char *where)
+{
+	char c;
+	int a, v;
+	unsigned int index, cmd;
+
+	for (a = 0; a < count; a += 2) {
+		cmd = index = COMMANDS;
+
+		while (index--) if (!strcmp(args[a], commands[index])) {
+			cmd = index >> 1;
+			break;
+		}
+
+		if (cmd == COMMANDS) {
+			printf("error: %sinvalid option \"%s\"\n", where, args[a]);
+			return EINVAL;
+		}
+
+		if (a + 1 != count) switch (cmd) {
+			case BRIGHTNESS:
+				if ((v = get_integer(args[a + 1])) == -1 || v > 255) break;
+				led->static_brightness = (unsigned char) v;
+				continue;
+
+			case MODE:
+				if (	strlen(args[a + 1]) > 1 || 
+					((c = args[a + 1][0]) != 'd' && c != 'n' && c != 'm')
+				) break;
+				led->pulse_table = (c & 3) ? ~c & 3 : 0; /* :-) */
+				continue;
+
+			case SPEED:
+				if ((v = get_integer(args[a + 1])) == -1 || v > 1000) break;
+				led->pulse_speed = (unsigned short) v;
+				continue;
+
+			case PULSE_AWAKE:
+				if (!strcmp(args[a + 1], "on")) led->pulse_awake = POWERMATE_PULSE_STATE_ON;
+				else if (!strcmp(args[a + 1], "off")) led->pulse_awake = POWERMATE_PULSE_STATE_OFF;
+				else break;
+				continue;
+
+			case PULSE_ASLEEP:
+				if (!strcmp(args[a + 1], "on")) led->pulse_asleep = POWERMATE_PULSE_STATE_ON;
+				else if (!strcmp(args[a + 1], "off")) led->pulse_asleep = POWERMATE_PULSE_STATE_OFF;
+				else break;
+				continue;
+		}
+
+		printf("error: %sbad sintax in \"%s\"\n", where, args[a]);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
+/* Real knobs get a single descriptor, grabbed if asked to. Stand-ins
+(FIFOs) are wrapped as they are when any_node is set. */
+
+PowerMate *open_device(const char *path, int flags, int any_node, PowerMateHandlers *handlers)
+{
+	struct stat node;
+	PowerMate *pm;
+	int fd;
+
+	if (stat(path, &node)) return NULL;
+	if (S_ISCHR(node.st_mode)) return powermate_new_options(path, POWERMATE_OPEN_SINGLE_FD | flags, handlers);
+
+	if (!any_node) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	if ((fd = open(path, O_RDWR | O_CLOEXEC | (flags & POWERMATE_OPEN_NONBLOCK ? O_NONBLOCK : 0))) == -1)
+		return NULL;
+
+	if ((pm = powermate_new_from_fd(fd, fd, handlers)) == NULL) {
+		int error = errno;
+
+		close(fd);
+		errno = error;
+	}
+
+	return pm;
+}
+
+
+/*	Daemon mode
+
+	Owns every PowerMate found in a directory (hot-plugged ones too)
+	and serves local clients over a Unix stream socket, one text line
+	per message:
+
+	daemon to clients	A <slot> <path>			device added
+				R <slot> <path>			device removed
+				E <slot> <kind> <value> <tesle>	event (left, right, down,
+								up, led)
+				L <applied> <failed>		reply to a command batch
+
+	clients to daemon	L <slot|*> <brightness> [<speed> <table> <asleep> <awake>]
+				S <0|1>				subscribe to the events
+								(the default) or not
+
+	Events of a whole dispatch round are sent to every subscriber with
+	a single write. A client whose queue reaches CLIENT_QUEUE bytes is
+	dropped instead of slowing down the others. The LED commands read
+	at once are merged per device and applied together.		*/
+
+
+typedef struct {
+	int fd;
+	int subscribed;
+	char *queue;			 /* output not written yet */
+	size_t queued;
+	char input[CLIENT_INPUT];	 /* incomplete command line */
+	size_t received;
+} Client;
+
+typedef struct {
+	PowerMateLoop *loop;
+	PowerMateWatch *watch;
+	int any_node;			 /* FIFOs and other stand-ins are devices too */
+	int listener;
+	PowerMate *devices[DAEMON_DEVICES];
+	char *paths[DAEMON_DEVICES];
+	Client clients[DAEMON_CLIENTS];
+	unsigned int client_count;
+	char frame[FRAME_SIZE];		 /* events of the running dispatch round */
+	size_t framed;
+	unsigned long long int dropped;	 /* clients dropped for being too slow */
+} Server;
+
+volatile sig_atomic_t quit;
+
+
+void on_signal(int signal)
+{
+	quit = 1;
+}
+
+
+void drop_client(Server *server, unsigned int index)
+{
+	Client *client = server->clients + index;
+
+	close(client->fd);
+	free(client->queue);
+	*client = server->clients[--server->client_count];
+}
+
+
+/* Appends to the queue of a client, -1 if it had to be dropped */
+
+int queue_client(Server *server, unsigned int index, const char *data, size_t size)
+{
+	Client *client = server->clients + index;
+
+	if (client->queued + size > CLIENT_QUEUE) {
+		server->dropped++;
+		drop_client(server, index);
+		return -1;
+	}
+
+	memcpy(client->queue + client->queued, data, size);
+	client->queued += size;
+	return 0;
+}
+
+
+int flush_client(Server *server, unsigned int index)
+{
+	Client *client = server->clients + index;
+	ssize_t size;
+
+	while (client->queued) {
+		if ((size = write(client->fd, client->queue, client->queued)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			drop_client(server, index);
+			return -1;
+		}
+
+		memmove(client->queue, client->queue + size, client->queued - (size_t)size);
+		client->queued -= (size_t)size;
+	}
+
+	return 0;
+}
+
+
+/* Hands the frame to every subscriber */
+
+void broadcast(Server *server)
+{
+	unsigned int index;
+
+	for (index = server->client_count; index--;) if (server->clients[index].subscribed)
+		queue_client(server, index, server->frame, server->framed);
+
+	server->framed = 0;
+}
+
+
+void emit(Server *server, const char *format, ...)
+{
+	va_list arguments;
+	int size;
+
+	for (;;) {
+		va_start(arguments, format);
+		size = vsnprintf(server->frame + server->framed, FRAME_SIZE - server->framed, format, arguments);
+		va_end(arguments);
+
+		if (size < 0) return;
+		if ((size_t)size < FRAME_SIZE - server->framed) break;
+		if (!server->framed) return;
+		broadcast(server);
+	}
+
+	server->framed += (size_t)size;
+}
+
+
+int find_device(Server *server, PowerMate *pm)
+{
+	int slot;
+
+	for (slot = 0; slot < DAEMON_DEVICES; slot++) if (server->devices[slot] == pm) return slot;
+	return -1;
+}
+
+
+int on_rotate_left(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	emit((Server *)data, "E %d left %u %llu\n", find_device((Server *)data, pm), units, tesle);
+	return 0;
+}
+
+
+int on_rotate_right(PowerMate *pm, void *data, unsigned long long int tesle, unsigned int units)
+{
+	emit((Server *)data, "E %d right %u %llu\n", find_device((Server *)data, pm), units, tesle);
+	return 0;
+}
+
+
+int on_button_down(PowerMate *pm, void *data, unsigned long long int tesle)
+{
+	emit((Server *)data, "E %d down 1 %llu\n", find_device((Server *)data, pm), tesle);
+	return 0;
+}
+
+
+int on_button_up(PowerMate *pm, void *data, unsigned long long int tesle)
+{
+	emit((Server *)data, "E %d up 0 %llu\n", find_device((Server *)data, pm), tesle);
+	return 0;
+}
+
+
+int on_led_echo(PowerMate *pm, void *data, unsigned long long int tesle, PowerMateLED *led)
+{
+	emit((Server *)data, "E %d led %u %llu\n", find_device((Server *)data, pm), led->static_brightness, tesle);
+	return 0;
+}
+
+
+void drop_device(Server *server, int slot)
+{
+	emit(server, "R %d %s\n", slot, server->paths[slot]);
+	if (server->devices[slot]->loop != NULL) powermate_loop_remove(server->loop, server->devices[slot]);
+	powermate_destroy(server->devices[slot]);
+	free(server->paths[slot]);
+	server->devices[slot] = NULL;
+	server->paths[slot] = NULL;
+}
+
+
+int on_device_added(PowerMateWatch *watch, void *data, const char *path)
+{
+	Server *server = (Server *)data;
+	PowerMateHandlers handlers = {
+		on_rotate_left, on_rotate_right, on_button_down, on_button_up, on_led_echo, server
+	};
+
+	PowerMate *pm;
+	int slot;
+
+	if (	(slot = find_device(server, NULL)) == -1 ||
+		(pm = open_device(path, POWERMATE_OPEN_GRAB | POWERMATE_OPEN_NONBLOCK, server->any_node, &handlers)) == NULL
+	) return 0;
+
+	if ((server->paths[slot] = strdup(path)) == NULL || powermate_loop_add(server->loop, pm)) {
+		free(server->paths[slot]);
+		server->paths[slot] = NULL;
+		powermate_destroy(pm);
+		return 0;
+	}
+
+	server->devices[slot] = pm;
+	emit(server, "A %d %s\n", slot, path);
+	return 0;
+}
+
+
+int on_device_removed(PowerMateWatch *watch, void *data, const char *path)
+{
+	Server *server = (Server *)data;
+	int slot;
+
+	for (slot = 0; slot < DAEMON_DEVICES; slot++)
+		if (server->paths[slot] != NULL && !strcmp(server->paths[slot], path)) drop_device(server, slot);
+
+	return 0;
+}
+
+
+void accept_clients(Server *server)
+{
+	Client *client;
+	char line[64 + PATH_MAX];
+	int fd, slot;
+
+	while ((fd = accept(server->listener, NULL, NULL)) != -1) {
+		if (	server->client_count == DAEMON_CLIENTS ||
+			fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1
+		) {
+			close(fd);
+			continue;
+		}
+
+		client = server->clients + server->client_count;
+		memset(client, 0, sizeof(Client));
+
+		if ((client->queue = (char *)malloc(CLIENT_QUEUE)) == NULL) {
+			close(fd);
+			continue;
+		}
+
+		client->fd = fd;
+		client->subscribed = 1;
+		server->client_count++;
+
+		/* Newcomers learn the devices already there */
+
+		for (slot = 0; slot < DAEMON_DEVICES; slot++) if (server->devices[slot] != NULL) {
+			snprintf(line, sizeof(line), "A %d %s\n", slot, server->paths[slot]);
+			queue_client(server, server->client_count - 1, line, strlen(line));
+		}
+	}
+}
+
+
+/* Parses "L <slot|*> <brightness> [<speed> <table> <asleep> <awake>]"
+into the batch, the last setting of each device wins */
+
+int parse_led(Server *server, char *line, PowerMate **pms, PowerMateLED *leds, unsigned int *count)
+{
+	PowerMateLED led;
+	unsigned long int values[5];
+	unsigned int index;
+	char target[16];
+	int fields, slot, first, last;
+
+	fields = sscanf(line, "L %15s %lu %lu %lu %lu %lu",
+		target, values, values + 1, values + 2, values + 3, values + 4);
+
+	/* Checked before the casts, which would wrap */
+
+	if (	(fields != 2 && fields != 6) || values[0] > 255 ||
+		(fields == 6 && (values[1] > 510 || values[2] > 2 || values[3] > 1 || values[4] > 1))
+	) return -1;
+
+	if (!strcmp(target, "*")) {
+		first = 0;
+		last = DAEMON_DEVICES - 1;
+
+	} else if ((first = last = atoi(target)) < 0 || first >= DAEMON_DEVICES || server->devices[first] == NULL)
+		return -1;
+
+	for (slot = first; slot <= last; slot++) if (server->devices[slot] != NULL) {
+		led = server->devices[slot]->led;
+		led.static_brightness = (unsigned char)values[0];
+
+		if (fields == 6) {
+			led.pulse_speed = (unsigned short)values[1];
+			led.pulse_table = (unsigned char)values[2];
+			led.pulse_asleep = (unsigned char)values[3];
+			led.pulse_awake = (unsigned char)values[4];
+		}
+
+		for (index = 0; index < *count && pms[index] != server->devices[slot]; index++);
+		if (index == *count) pms[(*count)++] = server->devices[slot];
+		leds[index] = led;
+	}
+
+	return 0;
+}
+
+
+/* Reads the commands of a client. Returns -1 if it was dropped. */
+
+int read_client(Server *server, unsigned int index)
+{
+	Client *client = server->clients + index;
+	PowerMate *pms[DAEMON_DEVICES];
+	PowerMateLED leds[DAEMON_DEVICES];
+	unsigned int count = 0, errors = 0;
+	char *line, *end, reply[32];
+	ssize_t size;
+	int failed = 0;
+
+	for (;;) {
+		if ((size = read(client->fd, client->input + client->received, CLIENT_INPUT - client->received)) <= 0) {
+			if (size == -1 && errno == EINTR) continue;
+			if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			drop_client(server, index);
+			return -1;
+		}
+
+		client->received += (size_t)size;
+
+		for (line = client->input; (end = memchr(line, '\n', client->received - (size_t)(line - client->input))) != NULL; line = end + 1) {
+			*end = 0;
+			if (line[0] == 'L') errors += parse_led(server, line, pms, leds, &count) != 0;
+			else if (line[0] == 'S') client->subscribed = atoi(line + 1) != 0;
+			else errors++;
+		}
+
+		client->received -= (size_t)(line - client->input);
+		memmove(client->input, line, client->received);
+
+		/* A line filling the whole buffer will never end */
+
+		if (client->received == CLIENT_INPUT) {
+			drop_client(server, index);
+			return -1;
+		}
+	}
+
+	if (!count && !errors) return 0;
+	if (count && (failed = powermate_set_led_many(pms, count, leds, count, NULL)) < 0) failed = (int)count;
+	snprintf(reply, sizeof(reply), "L %u %u\n", count - (unsigned int)failed, (unsigned int)failed + errors);
+	return queue_client(server, index, reply, strlen(reply));
+}
+
+
+int run_daemon(const char *socket_path, const char *directory, int any_node)
+{
+	static Server server;
+	struct pollfd pfds[2 + DAEMON_CLIENTS];
+	struct sockaddr_un address;
+	struct sigaction action;
+	unsigned int index;
+	int slot, retval = 0;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		printf("error: socket path too long \"%s\"\n", socket_path);
+		return ENAMETOOLONG;
+	}
+
+	strcpy(address.sun_path, socket_path);
+	server.any_node = any_node;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (	(server.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ||
+		(unlink(socket_path) && errno != ENOENT) ||
+		bind(server.listener, (struct sockaddr *)&address, sizeof(address)) ||
+		listen(server.listener, 64) ||
+		(server.loop = powermate_loop_new()) == NULL ||
+		(server.watch = powermate_watch_new(
+			directory, any_node ? POWERMATE_WATCH_ANY_NODE : 0,
+			on_device_added, on_device_removed, &server)) == NULL ||
+		powermate_loop_add_watch(server.loop, server.watch) ||
+		powermate_watch_scan(server.watch)
+	) {
+		printf("error: can not start the daemon, errno = %d (%s)\n", errno, strerror(errno));
+		return errno;
+	}
+
+	server.framed = 0;
+
+	while (!quit) {
+		pfds[0].fd = server.loop->fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = server.listener;
+		pfds[1].events = POLLIN;
+
+		for (index = 0; index < server.client_count; index++) {
+			pfds[2 + index].fd = server.clients[index].fd;
+			pfds[2 + index].events = POLLIN | (server.clients[index].queued ? POLLOUT : 0);
+		}
+
+		if (poll(pfds, 2 + server.client_count, -1) == -1) {
+			if (errno == EINTR) continue;
+			retval = errno;
+			break;
+		}
+
+		/* Devices which failed are dropped, the loop has already
+		forgotten them */
+
+		if (pfds[0].revents && powermate_loop_dispatch(server.loop, 0) && server.loop->failed != NULL) {
+			if ((slot = find_device(&server, server.loop->failed)) != -1) drop_device(&server, slot);
+			server.loop->failed = NULL;
+		}
+
+		/* Dropping a client moves the last one to its place,
+		which has been handled already */
+
+		for (index = server.client_count; index--;)
+			if (pfds[2 + index].revents & (POLLIN | POLLHUP | POLLERR)) read_client(&server, index);
+
+		if (pfds[1].revents) accept_clients(&server);
+
+		if (server.framed) broadcast(&server);
+		for (index = server.client_count; index--;) flush_client(&server, index);
+	}
+
+	for (slot = 0; slot < DAEMON_DEVICES; slot++) if (server.devices[slot] != NULL) drop_device(&server, slot);
+	while (server.client_count) drop_client(&server, server.client_count - 1);
+	powermate_loop_destroy(server.loop);
+	powermate_watch_destroy(server.watch);
+	close(server.listener);
+	unlink(socket_path);
+	return retval;
+}
+
+
+/*	Batch mode
+
+	Reads lines of "<DEVICE> [OPTION VALUE ...]", the options being
+	those of the command line ('#' starts a comment), opens all the
+	devices from a few threads, writes every LED with a single
+	powermate_set_led_many() call and prints a result per device. The
+	devices are registered in a PowerMateUring for the call, so that
+	all the writes go out in one submission (in turn without
+	io_uring).							*/
+
+
+typedef struct {
+	char *device;
+	unsigned int line;
+	PowerMateLED led;
+	PowerMate *pm;
+	int error;			 /* errno of the open or the write, 0 if done */
+	double open_time;		 /* seconds */
+} Job;
+
+typedef struct {
+	Job *jobs;
+	unsigned int count;
+	unsigned int next;		 /* next job to open, shared by the threads */
+	int any_node;
+} Batch;
+
+
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void *open_jobs(void *argument)
+{
+	Batch *batch = (Batch *)argument;
+	unsigned int index;
+	Job *job;
+
+	while ((index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+		job = batch->jobs + index;
+		job->open_time = now();
+
+		if ((job->pm = open_device(job->device, 0, batch->any_node, NULL)) == NULL) job->error = errno;
+		else if (job->pm->output == -1) job->error = EACCES;
+
+		job->open_time = now() - job->open_time;
+	}
+
+	return NULL;
+}
+
+
+/* Reads the jobs, returns 0 or the errno of the failure (reported) */
+
+int read_jobs(FILE *file, Batch *batch)
+{
+	char line[4096], where[32], *args[BATCH_ARGUMENTS], *word;
+	unsigned int number = 0, size = 0;
+	PowerMateLED led = {255, 255, 1, 0, 0};
+	Job *jobs;
+	int count, retval;
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		if ((word = strchr(line, '#')) != NULL) *word = 0;
+
+		for (count = 0, word = strtok(line, " \t\r\n"); word != NULL; word = strtok(NULL, " \t\r\n")) {
+			if (count == BATCH_ARGUMENTS) {
+				printf("error: line %u: too many options\n", number);
+				return EINVAL;
+			}
+
+			args[count++] = word;
+		}
+
+		if (!count) continue;
+
+		if (batch->count == size) {
+			if ((jobs = (Job *)realloc(batch->jobs, (size ? size * 2 : 64) * sizeof(Job))) == NULL) {
+				printf("error: out of memory\n");
+				return ENOMEM;
+			}
+
+			batch->jobs = jobs;
+			size = size ? size * 2 : 64;
+		}
+
+		snprintf(where, sizeof(where), "line %u: ", number);
+		batch->jobs[batch->count].led = led;
+		if ((retval = parse_options(args + 1, count - 1, &batch->jobs[batch->count].led, where))) return retval;
+
+		if ((batch->jobs[batch->count].device = strdup(args[0])) == NULL) {
+			printf("error: out of memory\n");
+			return ENOMEM;
+		}
+
+		batch->jobs[batch->count].line = number;
+		batch->jobs[batch->count].pm = NULL;
+		batch->jobs[batch->count].error = 0;
+		batch->count++;
+	}
+
+	return 0;
+}
+
+
+int run_batch(const char *path, int any_node)
+{
+	pthread_t threads[BATCH_THREADS];
+	PowerMate **pms = NULL;
+	PowerMateLED *leds = NULL;
+	PowerMateUring *uring = NULL;
+	Batch batch;
+	FILE *file = stdin;
+	unsigned int index, count = 0, threads_count = 0, failed = 0, ring = 0;
+	unsigned long long int write_errors = 0;
+	int *results = NULL, retval;
+	double start = now(), write_time;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.any_node = any_node;
+
+	if (path != NULL && strcmp(path, "-") && (file = fopen(path, "r")) == NULL) {
+		retval = errno;
+		printf("error: can not open \"%s\", errno = %d (%s)\n", path, retval, strerror(retval));
+		return retval;
+	}
+
+	retval = read_jobs(file, &batch);
+	if (file != stdin) fclose(file);
+	if (retval) goto done;
+
+	threads_count = batch.count < BATCH_THREADS ? batch.count : BATCH_THREADS;
+
+	for (index = 0; index < threads_count; index++)
+		if ((errno = pthread_create(threads + index, NULL, open_jobs, &batch))) break;
+
+	/* Whatever the threads could not be started for is done here */
+
+	threads_count = index;
+	open_jobs(&batch);
+	for (index = 0; index < threads_count; index++) pthread_join(threads[index], NULL);
+
+	if (	(pms = (PowerMate **)malloc((batch.count + 1) * sizeof(PowerMate *))) == NULL ||
+		(leds = (PowerMateLED *)malloc((batch.count + 1) * sizeof(PowerMateLED))) == NULL ||
+		(results = (int *)malloc((batch.count + 1) * sizeof(int))) == NULL
+	) {
+		printf("error: out of memory\n");
+		retval = ENOMEM;
+		goto done;
+	}
+
+	for (index = 0; index < batch.count; index++) if (!batch.jobs[index].error) {
+		pms[count] = batch.jobs[index].pm;
+		leds[count++] = batch.jobs[index].led;
+	}
+
+	/* Devices the ring can not take are written in turn. Its reads
+	are posted before the clock starts. */
+
+	if (count && (uring = powermate_uring_new(count)) != NULL) {
+		for (index = 0; index < count; index++) ring += !powermate_uring_add(uring, pms[index]);
+		if (powermate_uring_submit(uring)) ring = 0;
+	}
+
+	write_time = now();
+
+	if (count && powermate_set_led_many(pms, count, leds, count, results) == -1)
+		for (index = 0; index < count; index++) results[index] = errno;
+
+	/* Removing a device waits for its write to complete */
+
+	if (uring != NULL) for (index = 0; index < uring->size; index++)
+		if (uring->slots[index].pm != NULL) powermate_uring_remove(uring, uring->slots[index].pm);
+
+	write_time = now() - write_time;
+
+	printf("%-6s %-32s %-28s %10s\n", "LINE", "DEVICE", "RESULT", "OPEN (us)");
+
+	for (index = 0, count = 0; index < batch.count; index++) {
+		Job *job = batch.jobs + index;
+
+		if (!job->error) job->error = results[count++];
+		if (job->error) failed++;
+
+		printf(	"%-6u %-32s %-28s %10.0f\n", job->line, job->device,
+			job->error ? strerror(job->error) : "ok", job->open_time * 1e6);
+	}
+
+	if (uring != NULL) {
+		write_errors = uring->write_errors;
+		powermate_uring_destroy(uring);
+	}
+
+	printf(	"%u devices, %u failed, %u threads, LED writes %.3f ms (%u through io_uring, %llu failed there), total %.3f ms\n",
+		batch.count, failed, threads_count + 1, write_time * 1e3, ring, write_errors, (now() - start) * 1e3);
+
+	retval = failed || write_errors ? EIO : 0;
+
+	done:
+	for (index = 0; index < batch.count; index++) {
+		if (batch.jobs[index].pm != NULL) powermate_destroy(batch.jobs[index].pm);
+		free(batch.jobs[index].device);
+	}
+
+	free(batch.jobs);
+	free(pms);
+	free(leds);
+	free(results);
+	return retval;
+}
+
+
 int main(int argc, char **argv)
 {
 	const char *help =
 		"usage: powermate-control <DEVICE> < [OPTION] <VALUE> ...>\n"
+		"       powermate-control --daemon <SOCKET> [DIRECTORY] [--any-node]\n"
+		"       powermate-control --batch [FILE] [--any-node]\n"
 		"\n"
 		"  -b --brightness [0-255]	set static brightness\n"
 		"  -m --mode [d|n|m]		set pulsation mode (divide/normal/multiply)\n"
 		"  -s --speed [0-510]		set pulsation speed (best results near 255)\n"
 		"  -n --pulse-awake [on/off]	activate/deactivate pulsation when host is running\n"
 		"  -f --pulse-asleep [on/off]	activate/deactivate pulsation when host is sleeping\n"
+		"  -d --daemon			serve the knobs of DIRECTORY (/dev/input) to clients of SOCKET,\n"
+		"				--any-node takes FIFOs as devices too (testing)\n"
+		"  -B --batch			apply the \"<DEVICE> [OPTION VALUE ...]\" lines of FILE\n"
+		"				(standard input by default) in one go\n"
 		"  -v --version			display program version and copyright\n"
 		"  -h --help			display this information";
 
@@ -65,17 +861,7 @@ int main(int argc, char **argv)
 		"Distributed under the terms of the GNU General Public License version 2\n"
 		"Website: http://www.nongnu.org/libpowermate/";
 
-	const char *commands[] = {
-		"-b", "--brightness",
-		"-m", "--mode",
-		"-s", "--speed",
-		"-n", "--pulse-awake",
-		"-f", "--pulse-asleep"
-	};
-
-	char c;
-	int a, v, retval = 0;
-	unsigned int i, index, cmd;
+	int retval = 0;
 	PowerMate *pm;
 	PowerMateLED led = {255, 255, 1, 0, 0};
 
@@ -89,6 +875,28 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (!strcmp(argv[1], "-d") || !strcmp(argv[1], "--daemon")) {
+		int any_node = argc > 3 && !strcmp(argv[argc - 1], "--any-node");
+
+		if (argc < 3 || argc - any_node > 4) {
+			puts(help);
+			return EINVAL;
+		}
+
+		return run_daemon(argv[2], argc - any_node == 4 ? argv[3] : NULL, any_node);
+	}
+
+	if (!strcmp(argv[1], "-B") || !strcmp(argv[1], "--batch")) {
+		int any_node = argc > 2 && !strcmp(argv[argc - 1], "--any-node");
+
+		if (argc - any_node > 3) {
+			puts(help);
+			return EINVAL;
+		}
+
+		return run_batch(argc - any_node == 3 ? argv[2] : NULL, any_node);
+	}
+
 	if ((pm = powermate_new(argv[1], NULL)) == NULL) {
 		switch (errno) {
 			case ENODEV:
@@ -110,53 +918,7 @@ int main(int argc, char **argv)
 			goto end;
 		}
 
-		for (a = 2; a < argc; a += 2) {
-			cmd = index = COMMANDS;
-
-			while (index--) if (!strcmp(argv[a], commands[index])) {
-				cmd = index >> 1;
-				break;
-			}
-
-			if (cmd == COMMANDS) {
-				printf("error: invalid option \"%s\"\n", argv[a]);
-				return EINVAL;
-			}
-
-			if (a + 1 != argc) switch (cmd) {
-				case BRIGHTNESS:
-					if ((v = get_integer(argv[a + 1])) == -1 || v > 255) break;
-					led.static_brightness = (unsigned char) v;
-					continue;
-
-				case MODE:
-					if (	strlen(argv[a + 1]) > 1 || 
-						((c = argv[a + 1][0]) != 'd' && c != 'n' && c != 'm')
-					) break;
-					led.pulse_table = (c & 3) ? ~c & 3 : 0; /* :-) */
-					continue;
-
-				case SPEED:
-					if ((v = get_integer(argv[a + 1])) == -1 || v > 1000) break;
-					led.pulse_speed = (unsigned short) v;
-					continue;
-
-				case PULSE_AWAKE:
-					if (!strcmp(argv[a + 1], "on")) led.pulse_awake = POWERMATE_PULSE_STATE_ON;
-					else if (!strcmp(argv[a + 1], "off")) led.pulse_awake = POWERMATE_PULSE_STATE_OFF;
-					else break;
-					continue;
-
-				case PULSE_ASLEEP:
-					if (!strcmp(argv[a + 1], "on")) led.pulse_asleep = POWERMATE_PULSE_STATE_ON;
-					else if (!strcmp(argv[a + 1], "off")) led.pulse_asleep = POWERMATE_PULSE_STATE_OFF;
-					else break;
-					continue;
-			}
-
-			printf("error: bad sintax in \"%s\"\n", argv[a]);
-			return EINVAL;
-		}
+		if ((retval = parse_options(argv + 2, argc - 2, &led, ""))) return retval;
 
 		if (powermate_set_led(pm, &led)) {
 			printf("error: can not configure PowerMate LED, errno = %d (%s)\n", errno, strerror(errno));
@@ -0,0 +1,348 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "powermate.h"
+#include <sys/epoll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Ready descriptors fetched with each epoll_wait() */
+#define POWERMATE_LOOP_EVENTS 64
+
+
+PowerMateLoop *powermate_loop_new(void)
+{
+	PowerMateLoop *loop = (PowerMateLoop *)calloc(1, sizeof(PowerMateLoop));
+
+	if (loop == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((loop->ready = malloc(POWERMATE_LOOP_EVENTS * sizeof(struct epoll_event))) == NULL) {
+		free(loop);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((loop->fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		free(loop->ready);
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+
+/* Registered devices, watcher and animator are not destroyed, they belong to the caller */
+
+int powermate_loop_destroy(PowerMateLoop *loop)
+{
+	close(loop->fd);
+	free(loop->ready);
+	free(loop);
+	return 0;
+}
+
+
+int powermate_loop_add(PowerMateLoop *loop, PowerMate *pm)
+{
+	struct epoll_event event;
+	int flags;
+
+	if ((flags = fcntl(pm->input, F_GETFL)) == -1) return -1;
+	if (fcntl(pm->input, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+
+	event.events = EPOLLIN;
+	event.data.ptr = pm;
+
+	if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, pm->input, &event) == -1) {
+		int error = errno;
+
+		fcntl(pm->input, F_SETFL, flags);
+		errno = error;
+		return -1;
+	}
+
+	pm->nonblock = 1;
+	pm->loop = loop;
+	loop->count++;
+	return 0;
+}
+
+
+/* Forgets a registration in the descriptors still to be processed by
+the running dispatch, so that callbacks can remove and destroy devices */
+
+static void powermate_loop_forget(PowerMateLoop *loop, void *ptr)
+{
+	struct epoll_event *ready = (struct epoll_event *)loop->ready;
+	int index;
+
+	for (index = loop->ready_index; index < loop->ready_count; index++)
+		if (ready[index].data.ptr == ptr) ready[index].data.ptr = NULL;
+}
+
+
+int powermate_loop_remove(PowerMateLoop *loop, PowerMate *pm)
+{
+	int flags;
+
+	if (epoll_ctl(loop->fd, EPOLL_CTL_DEL, pm->input, NULL) == -1) return -1;
+
+	/* Devices opened non-blocking stay so */
+
+	if (!(pm->flags & POWERMATE_OPEN_NONBLOCK)) {
+		if ((flags = fcntl(pm->input, F_GETFL)) != -1)
+			fcntl(pm->input, F_SETFL, flags & ~O_NONBLOCK);
+
+		pm->nonblock = 0;
+	}
+
+	pm->loop = NULL;
+	if (loop->pending == pm) loop->pending = NULL;
+	powermate_loop_forget(loop, pm);
+
+	if (pm->led_writer.queued) {
+		PowerMate **link = &loop->deferred;
+
+		while (*link != pm) link = &(*link)->deferred;
+		*link = pm->deferred;
+		pm->led_writer.queued = 0;
+	}
+
+	loop->count--;
+	return 0;
+}
+
+
+/* Dispatches everything queued for one device. Running out of
+events is not an error here, but a dead device is dropped from
+the loop and reported through loop->failed. */
+
+static int powermate_loop_drain(PowerMateLoop *loop, PowerMate *pm)
+{
+	int retval = powermate_get_events(pm);
+
+	if (retval == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+		retval = errno;
+		powermate_loop_remove(loop, pm);
+		loop->failed = pm;
+		errno = retval;
+		return -1;
+	}
+
+	/* A handler stopped the dispatch, buffered events must
+	be delivered before waiting again as the fd may be idle */
+
+	if (pm->buffer_end != pm->buffer_begin) loop->pending = pm;
+	return retval;
+}
+
+
+/* The nearest of two timeouts, -1 meaning none */
+
+static int powermate_loop_nearest(int timeout, int other)
+{
+	return timeout == -1 || (other != -1 && other < timeout) ? other : timeout;
+}
+
+
+/* Writes the deferred LED words whose slot has come, dropping the
+devices with nothing left to wait for from the list, and shortens the
+wait to the nearest LED slot, merged rotation or gesture timeout still
+deferred. */
+
+static int powermate_loop_sync(PowerMateLoop *loop, int timeout)
+{
+	PowerMate **link = &loop->deferred, *pm;
+	int device_timeout;
+
+	while ((pm = *link) != NULL) {
+		device_timeout = powermate_loop_nearest(
+			powermate_loop_nearest(powermate_sync_led(pm), powermate_gesture_timeout(pm)),
+			powermate_coalescing_timeout(pm));
+
+		if (device_timeout == -1) {
+			*link = pm->deferred;
+			pm->led_writer.queued = 0;
+			continue;
+		}
+
+		timeout = powermate_loop_nearest(timeout, device_timeout);
+		link = &pm->deferred;
+	}
+
+	return timeout;
+}
+
+
+/* Merged rotation and gesture timeouts are delivered by draining the
+device, which runs its due work before finding the input empty. The
+list is walked again after every call as handlers may remove or
+destroy devices. */
+
+static int powermate_loop_expire(PowerMateLoop *loop)
+{
+	PowerMate *pm;
+	int retval;
+
+	for (pm = loop->deferred; pm != NULL;) {
+		if (powermate_gesture_timeout(pm) && powermate_coalescing_timeout(pm)) {
+			pm = pm->deferred;
+			continue;
+		}
+
+		if ((retval = powermate_loop_drain(loop, pm))) return retval;
+		pm = loop->deferred;
+	}
+
+	return 0;
+}
+
+
+/* Only one watcher and one animator per loop, they are told apart
+from the devices by their registration pointers */
+
+int powermate_loop_add_watch(PowerMateLoop *loop, PowerMateWatch *watch)
+{
+	struct epoll_event event;
+
+	if (loop->watch != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = watch;
+	if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, watch->fd, &event) == -1) return -1;
+	loop->watch = watch;
+	return 0;
+}
+
+
+int powermate_loop_remove_watch(PowerMateLoop *loop)
+{
+	if (loop->watch == NULL) return 0;
+	if (epoll_ctl(loop->fd, EPOLL_CTL_DEL, loop->watch->fd, NULL) == -1) return -1;
+	powermate_loop_forget(loop, loop->watch);
+	loop->watch = NULL;
+	return 0;
+}
+
+
+int powermate_loop_add_animator(PowerMateLoop *loop, PowerMateAnimator *animator)
+{
+	struct epoll_event event;
+
+	if (loop->animator != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = animator;
+	if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, animator->fd, &event) == -1) return -1;
+	loop->animator = animator;
+	return 0;
+}
+
+
+int powermate_loop_remove_animator(PowerMateLoop *loop)
+{
+	if (loop->animator == NULL) return 0;
+	if (epoll_ctl(loop->fd, EPOLL_CTL_DEL, loop->animator->fd, NULL) == -1) return -1;
+	powermate_loop_forget(loop, loop->animator);
+	loop->animator = NULL;
+	return 0;
+}
+
+
+int powermate_loop_dispatch(PowerMateLoop *loop, int timeout)
+{
+	struct epoll_event *ready = (struct epoll_event *)loop->ready;
+	PowerMate *pm;
+	void *ptr;
+	int retval;
+
+	if ((pm = loop->pending) != NULL) {
+		loop->pending = NULL;
+		if ((retval = powermate_loop_drain(loop, pm))) return retval;
+	}
+
+	if (loop->deferred != NULL) timeout = powermate_loop_sync(loop, timeout);
+
+	if ((loop->ready_count = epoll_wait(loop->fd, ready, POWERMATE_LOOP_EVENTS, timeout)) == -1) {
+		loop->ready_count = 0;
+		return errno == EINTR ? 0 : -1;
+	}
+
+	if (loop->ready_count) loop->wakeups++;
+
+	if (loop->deferred != NULL) {
+		powermate_loop_sync(loop, -1);
+
+		if ((retval = powermate_loop_expire(loop))) {
+			loop->ready_count = 0;
+			return retval;
+		}
+	}
+
+	/* Devices not reached because a handler stopped the loop
+	are still readable and will be reported again */
+
+	for (loop->ready_index = 0; loop->ready_index < loop->ready_count;) {
+		if ((ptr = ready[loop->ready_index++].data.ptr) == NULL) continue;
+
+		if ((retval = ptr == loop->watch
+			? powermate_watch_dispatch(loop->watch)
+			: ptr == loop->animator
+			? powermate_animator_dispatch(loop->animator)
+			: powermate_loop_drain(loop, (PowerMate *)ptr)
+		)) {
+			loop->ready_count = 0;
+			return retval;
+		}
+	}
+
+	loop->ready_count = 0;
+	return 0;
+}
+
+
+int powermate_loop_run(PowerMateLoop *loop)
+{
+	int retval;
+
+	while (!(retval = powermate_loop_dispatch(loop, -1)));
+	return retval;
+}
+
+
+/* powermate-loop.c EOF */
@@ -0,0 +1,39 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef __POWERMATE_PRIVATE_H__
+#define __POWERMATE_PRIVATE_H__
+
+#include "powermate.h"
+
+/* Hooks shared by the library modules, not part of the API */
+
+void		powermate_stats_event		(PowerMate *pm,
+						struct pm_event *event);
+void		powermate_publish_event		(PowerMateSharedDevice *device,
+						const struct pm_event *event);
+PowerMateUring*	powermate_uring_of		(PowerMate *pm);
+
+#endif /* __POWERMATE_PRIVATE_H__ */
@@ -0,0 +1,297 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+
+#include "powermate-private.h"
+#include <linux/input.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Seqlock writer and reader, C11 memory model through the GCC atomic
+builtins: the fields are accessed atomically (relaxed) so that a copy
+racing with a write is merely discarded, never undefined. */
+
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define LOAD(field)	    __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+
+static void powermate_publish_begin(PowerMateSharedDevice *device)
+{
+	STORE(device->sequence, device->sequence + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void powermate_publish_end(PowerMateSharedDevice *device)
+{
+	__atomic_store_n(&device->sequence, device->sequence + 1, __ATOMIC_RELEASE);
+}
+
+
+static PowerMateSharedDevice *powermate_shared_slot(const PowerMateShared *shared, unsigned int slot)
+{
+	return (PowerMateSharedDevice *)(shared + 1) + slot;
+}
+
+
+/* Creates the segment, usually under /dev/shm so that it never
+reaches the disk. It is readable by everyone and writable only by
+the publisher. */
+
+PowerMatePublisher *powermate_publisher_new(const char *path, unsigned int slots)
+{
+	PowerMatePublisher *publisher;
+	void *mapping;
+
+	if (!slots) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((publisher = (PowerMatePublisher *)calloc(1, sizeof(PowerMatePublisher))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	publisher->size = sizeof(PowerMateShared) + slots * sizeof(PowerMateSharedDevice);
+
+	if ((publisher->path = strdup(path)) == NULL) {
+		errno = ENOMEM;
+		goto error;
+	}
+
+	if ((publisher->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) goto error;
+
+	if (	ftruncate(publisher->fd, (off_t)publisher->size) ||
+		(mapping = mmap(NULL, publisher->size, PROT_READ | PROT_WRITE, MAP_SHARED, publisher->fd, 0)) == MAP_FAILED
+	) {
+		int error = errno;
+
+		close(publisher->fd);
+		unlink(path);
+		errno = error;
+		goto error;
+	}
+
+	/* The file is zero-filled, every slot is inactive with an even
+	sequence. The magic goes last, readers check it. */
+
+	publisher->shared = (PowerMateShared *)mapping;
+	publisher->shared->version = POWERMATE_SHARED_VERSION;
+	publisher->shared->slots = slots;
+	__atomic_store_n(&publisher->shared->magic, POWERMATE_SHARED_MAGIC, __ATOMIC_RELEASE);
+	return publisher;
+
+	error:
+	free(publisher->path);
+	free(publisher);
+	return NULL;
+}
+
+
+/* Refused with EBUSY while devices are published in the segment, they
+would go on writing to it once unmapped */
+
+int powermate_publisher_destroy(PowerMatePublisher *publisher)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < publisher->shared->slots; slot++)
+		if (LOAD(powermate_shared_slot(publisher->shared, slot)->active)) {
+			errno = EBUSY;
+			return -1;
+		}
+
+	unlink(publisher->path);
+	munmap((void *)publisher->shared, publisher->size);
+	close(publisher->fd);
+	free(publisher->path);
+	free(publisher);
+	return 0;
+}
+
+
+/* Publishes the state of a device in a slot from now on, its position
+starting at 0. Every event read updates it, and so does every LED
+word written. A device published elsewhere leaves its old slot. */
+
+int powermate_publish(PowerMatePublisher *publisher, PowerMate *pm, unsigned int slot)
+{
+	PowerMateSharedDevice *device;
+
+	if (slot >= publisher->shared->slots) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	device = powermate_shared_slot(publisher->shared, slot);
+
+	if (LOAD(device->active) && device != pm->published) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (pm->published != NULL && pm->published != device) powermate_unpublish(pm);
+	powermate_publish_begin(device);
+	STORE(device->position, 0);
+	STORE(device->time, 0);
+	STORE(device->events, 0);
+	STORE(device->pressed, pm->pressed);
+	STORE(device->led, pm->led_writer.valid ? pm->led_writer.word : 0);
+	STORE(device->active, 1);
+	powermate_publish_end(device);
+	pm->published = device;
+	return 0;
+}
+
+
+int powermate_unpublish(PowerMate *pm)
+{
+	PowerMateSharedDevice *device = pm->published;
+
+	if (device == NULL) return 0;
+	powermate_publish_begin(device);
+	STORE(device->active, 0);
+	powermate_publish_end(device);
+	pm->published = NULL;
+	return 0;
+}
+
+
+/* Applies an event to a slot. Only rotation, button and LED events
+change the state, frame markers cost nothing. */
+
+void powermate_publish_event(PowerMateSharedDevice *device, const struct pm_event *event)
+{
+	if (event->type != EV_REL && event->type != EV_KEY && event->type != EV_MSC) return;
+	powermate_publish_begin(device);
+
+	switch (event->type) {
+		case EV_REL:
+			STORE(device->position, device->position + (int)event->data);
+			break;
+
+		case EV_KEY:
+			STORE(device->pressed, event->data != 0);
+			break;
+
+		default:
+			STORE(device->led, event->data & 0x1FFFFF);
+	}
+
+	if (event->a || event->b) STORE(device->time, (long long int)event->a * 1000000 + event->b);
+	STORE(device->events, device->events + 1);
+	powermate_publish_end(device);
+}
+
+
+/* Maps a segment read-only, for any number of readers */
+
+const PowerMateShared *powermate_shared_open(const char *path)
+{
+	PowerMateShared *shared;
+	struct stat file_stat;
+	void *mapping;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return NULL;
+
+	if (fstat(fd, &file_stat)) {
+		close(fd);
+		return NULL;
+	}
+
+	if (	(size_t)file_stat.st_size < sizeof(PowerMateShared) ||
+		(mapping = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED
+	) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	close(fd);
+	shared = (PowerMateShared *)mapping;
+
+	if (	__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != POWERMATE_SHARED_MAGIC ||
+		shared->version != POWERMATE_SHARED_VERSION ||
+		sizeof(PowerMateShared) + shared->slots * sizeof(PowerMateSharedDevice) > (size_t)file_stat.st_size
+	) {
+		munmap(mapping, (size_t)file_stat.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return shared;
+}
+
+
+int powermate_shared_close(const PowerMateShared *shared)
+{
+	return munmap((void *)shared, sizeof(PowerMateShared) + shared->slots * sizeof(PowerMateSharedDevice));
+}
+
+
+/* Copies a slot, retrying while the publisher is writing it */
+
+int powermate_shared_read(const PowerMateShared *shared, unsigned int slot, PowerMateSample *sample)
+{
+	PowerMateSharedDevice *device;
+	unsigned int begin, led;
+
+	if (slot >= shared->slots) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	device = powermate_shared_slot(shared, slot);
+	sample->retries = 0;
+
+	for (;; sample->retries++) {
+		if ((begin = __atomic_load_n(&device->sequence, __ATOMIC_ACQUIRE)) & 1) continue;
+		sample->position = LOAD(device->position);
+		sample->time = LOAD(device->time);
+		sample->events = LOAD(device->events);
+		sample->pressed = LOAD(device->pressed);
+		sample->active = LOAD(device->active);
+		led = LOAD(device->led);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (LOAD(device->sequence) == begin) break;
+	}
+
+	sample->led.static_brightness = (unsigned char)(led & 0xFF);
+	sample->led.pulse_speed = (unsigned short)(led >> 8) & 0x1FF;
+	sample->led.pulse_table = (unsigned char)(led >> 17) & 3;
+	sample->led.pulse_asleep = (unsigned char)(led >> 19) & 1;
+	sample->led.pulse_awake = (unsigned char)(led >> 20) & 1;
+	return 0;
+}
+
+
+/* powermate-publish.c EOF */
@@ -0,0 +1,454 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+
+#include "powermate.h"
+#include <linux/input.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RING_MASK (POWERMATE_READER_EVENTS - 1)
+
+
+/*	Reader thread
+
+	The thread blocks on the device and moves every batch of events
+	into a single-producer/single-consumer ring, so that the kernel
+	queue keeps draining while handlers block. The device input is
+	replaced with an eventfd signalled after each batch, which works
+	with poll() and PowerMateLoop as the real descriptor did.
+
+	When the ring is full the thread keeps reading: rotation is folded
+	into a pending net amount and other events are discarded. Once
+	there is room again a SYN_DROPPED event is queued, followed by a
+	frame carrying the folded rotation and, if it changed, the button
+	state, so no units nor releases are lost. A SYN_DROPPED from the
+	kernel is handled the same way, the button state being read back
+	with EVIOCGKEY.
+
+	The thread polls the device along with an eventfd, written to
+	stop it, so it always quits between two reads.			*/
+
+
+static unsigned int powermate_reader_room(PowerMateReader *reader, unsigned int head)
+{
+	return POWERMATE_READER_EVENTS - (head - __atomic_load_n(&reader->tail, __ATOMIC_ACQUIRE));
+}
+
+
+/* Queues the SYN_DROPPED mark, then a frame with the folded rotation
+and the button state if it differs from the one last queued, once
+there is room for them. They are stamped as the last event read. */
+
+static unsigned int powermate_reader_resume(PowerMateReader *reader, unsigned int head)
+{
+	struct pm_event mark = reader->last;
+
+	if (!reader->overflowing || powermate_reader_room(reader, head) <= 4) return head;
+
+	mark.type = EV_SYN;
+	mark.code = SYN_DROPPED;
+	mark.data = 0;
+	reader->ring[head++ & RING_MASK] = mark;
+
+	if (reader->units) {
+		mark.type = EV_REL;
+		mark.code = REL_DIAL;
+		mark.data = (unsigned int)reader->units;
+		reader->ring[head++ & RING_MASK] = mark;
+	}
+
+	if (reader->pressed != reader->queued_pressed) {
+		mark.type = EV_KEY;
+		mark.code = BTN_0;
+		mark.data = reader->pressed;
+		reader->ring[head++ & RING_MASK] = mark;
+		reader->queued_pressed = reader->pressed;
+	}
+
+	if (mark.type != EV_SYN) {
+		mark.type = EV_SYN;
+		mark.code = SYN_REPORT;
+		mark.data = 0;
+		reader->ring[head++ & RING_MASK] = mark;
+	}
+
+	reader->units = 0;
+	reader->overflowing = 0;
+	return head;
+}
+
+
+/* Reads the button state back after the kernel dropped events. Stand-ins
+(pipes) keep the state of the last button event read. */
+
+static void powermate_reader_resync(PowerMateReader *reader)
+{
+	unsigned char keys[KEY_MAX / 8 + 1];
+
+	memset(keys, 0, sizeof(keys));
+
+	if (ioctl(reader->fd, EVIOCGKEY(sizeof(keys)), keys) >= 0)
+		reader->pressed = (keys[BTN_0 / 8] >> (BTN_0 % 8)) & 1;
+}
+
+
+static void powermate_reader_push(PowerMateReader *reader, struct pm_event *events, unsigned int count)
+{
+	unsigned int head = reader->head, index;
+	struct pm_event *e;
+
+	for (index = 0; index < count; index++) {
+		e = events + index;
+		head = powermate_reader_resume(reader, head);
+		reader->last = *e;
+
+		/* The events of the frame being dropped are discarded
+		as well, and the mark queued by resume() */
+
+		if (e->type == EV_SYN && e->code == SYN_DROPPED) {
+			reader->kernel_drops++;
+			powermate_reader_resync(reader);
+			reader->overflowing = 1;
+			continue;
+		}
+
+		if (e->type == EV_KEY && e->data < 2) reader->pressed = e->data;
+
+		if (!reader->overflowing && powermate_reader_room(reader, head)) {
+			reader->ring[head++ & RING_MASK] = *e;
+			if (e->type == EV_KEY && e->data < 2) reader->queued_pressed = e->data;
+			continue;
+		}
+
+		if (!reader->overflowing) {
+			reader->overflowing = 1;
+			reader->overflows++;
+		}
+
+		if (e->type == EV_REL) reader->units += (int)e->data;
+		reader->dropped++;
+	}
+
+	__atomic_store_n(&reader->head, powermate_reader_resume(reader, head), __ATOMIC_RELEASE);
+}
+
+
+/* Signals an eventfd. A counter too full to be added to (EAGAIN) is a
+wakeup already pending. */
+
+static int powermate_reader_notify(int fd)
+{
+	unsigned long long int one = 1;
+
+	while (write(fd, &one, sizeof(one)) == -1)
+		if (errno != EINTR) return errno == EAGAIN ? 0 : -1;
+
+	return 0;
+}
+
+
+/* While the ring is full the thread does not block on the device for
+long, the folded rotation is queued as soon as the consumer makes room
+even if the knob stays still. Also done before quitting on errors. */
+
+static int powermate_reader_wait(PowerMateReader *reader, int input, int quitting)
+{
+	struct pollfd pfd = {reader->fd, POLLIN, 0};
+
+	while (reader->overflowing && !__atomic_load_n(&reader->quit, __ATOMIC_ACQUIRE)) {
+		if (!quitting && poll(&pfd, 1, 1)) return 0;
+		__atomic_store_n(&reader->head, powermate_reader_resume(reader, reader->head), __ATOMIC_RELEASE);
+		if (powermate_reader_notify(input)) return -1;
+		if (quitting && reader->overflowing) poll(NULL, 0, 1);
+	}
+
+	return 0;
+}
+
+
+static void *powermate_reader_main(void *argument)
+{
+	PowerMate *pm = (PowerMate *)argument;
+	PowerMateReader *reader = pm->reader;
+	struct pm_event events[POWERMATE_BUFFER_EVENTS];
+	struct pollfd pfds[2] = {{reader->fd, POLLIN, 0}, {reader->wakeup, POLLIN, 0}};
+	size_t pending = 0;
+	ssize_t size;
+	int error;
+
+	for (;;) {
+		if (powermate_reader_wait(reader, pm->input, 0)) {
+			error = errno;
+			break;
+		}
+
+		if (poll(pfds, 2, -1) == -1) {
+			if (errno == EINTR) continue;
+			error = errno;
+			break;
+		}
+
+		if (pfds[1].revents) return NULL;
+
+		if ((size = read(reader->fd, (char *)events + pending, sizeof(events) - pending)) <= 0) {
+			if (size && errno == EINTR) continue;
+			error = size ? errno : ENODEV;
+			break;
+		}
+
+		/* Stream descriptors may split records */
+
+		pending += (size_t)size;
+		powermate_reader_push(reader, events, (unsigned int)(pending / sizeof(struct pm_event)));
+		memmove(events, (char *)events + pending - pending % sizeof(struct pm_event), pending % sizeof(struct pm_event));
+		pending %= sizeof(struct pm_event);
+
+		/* A consumer never woken would wait forever, the thread
+		quits and the error is reported by its next read() */
+
+		if (powermate_reader_notify(pm->input)) {
+			error = errno;
+			break;
+		}
+	}
+
+	/* The error is kept for the next read() even if the consumer
+	can not be woken any more */
+
+	powermate_reader_wait(reader, pm->input, 1);
+	__atomic_store_n(&reader->error, error, __ATOMIC_RELEASE);
+	powermate_reader_notify(pm->input);
+	return NULL;
+}
+
+
+/* Consumer side, the transport read() while the thread runs. An empty
+ring waits on the eventfd, or fails with EAGAIN if it is non-blocking. */
+
+static ssize_t powermate_reader_read(PowerMate *pm, void *buffer, size_t size)
+{
+	PowerMateReader *reader = (PowerMateReader *)pm->transport_data;
+	struct pm_event *events = (struct pm_event *)buffer;
+	unsigned long long int value;
+	unsigned int head, tail = reader->tail, count = 0;
+	int error;
+
+	for (;;) {
+		error = __atomic_load_n(&reader->error, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&reader->head, __ATOMIC_ACQUIRE);
+
+		if (head != tail) {
+			while (count < size / sizeof(struct pm_event) && tail != head)
+				events[count++] = reader->ring[tail++ & RING_MASK];
+
+			__atomic_store_n(&reader->tail, tail, __ATOMIC_RELEASE);
+			return (ssize_t)(count * sizeof(struct pm_event));
+		}
+
+		if (error) {
+			if (error == ENODEV) return 0;
+			errno = error;
+			return -1;
+		}
+
+		if (read(pm->input, &value, sizeof(value)) == -1) return -1;
+	}
+}
+
+
+/* LED words go through the replaced transport */
+
+static ssize_t powermate_reader_write(PowerMate *pm, const void *buffer, size_t size)
+{
+	PowerMateReader *reader = (PowerMateReader *)pm->transport_data;
+	ssize_t retval;
+
+	pm->transport_data = reader->transport_data;
+	retval = reader->transport->write(pm, buffer, size);
+	pm->transport_data = reader;
+	return retval;
+}
+
+
+static const char *powermate_reader_identify(PowerMate *pm)
+{
+	return pm->model_id;
+}
+
+
+/* A thread which can not be woken is left running */
+
+static int powermate_reader_halt(PowerMate *pm)
+{
+	PowerMateReader *reader = pm->reader;
+	int flags;
+
+	__atomic_store_n(&reader->quit, 1, __ATOMIC_RELEASE);
+
+	if (powermate_reader_notify(reader->wakeup)) {
+		__atomic_store_n(&reader->quit, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	pthread_join(reader->thread, NULL);
+	close(reader->wakeup);
+	close(pm->input);
+
+	pm->input = reader->fd;
+	pm->transport = reader->transport;
+	pm->transport_data = reader->transport_data;
+	pm->reader = NULL;
+
+	if (pm->nonblock && (flags = fcntl(pm->input, F_GETFL)) != -1)
+		fcntl(pm->input, F_SETFL, flags | O_NONBLOCK);
+
+	free(reader->ring);
+	free(reader);
+	return 0;
+}
+
+
+static int powermate_reader_close(PowerMate *pm)
+{
+	if (powermate_reader_halt(pm)) return -1;
+	return pm->transport->close(pm);
+}
+
+
+static const PowerMateTransport powermate_reader_transport = {
+	NULL,
+	powermate_reader_read,
+	powermate_reader_write,
+	powermate_reader_identify,
+	powermate_reader_close
+};
+
+
+/* Starts a thread draining the device input, which must be an evdev
+node or descriptor. It must be started before adding the device to a
+PowerMateLoop, which would watch the old input. */
+
+int powermate_start_reader(PowerMate *pm)
+{
+	PowerMateReader *reader;
+	int flags, error;
+
+	if (pm->reader != NULL || pm->loop != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (pm->transport != &powermate_evdev_transport) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pm->input < 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if ((reader = (PowerMateReader *)calloc(1, sizeof(PowerMateReader))) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if ((reader->ring = (struct pm_event *)malloc(
+		POWERMATE_READER_EVENTS * sizeof(struct pm_event))) == NULL
+	) {
+		free(reader);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* The thread itself must block on the device */
+
+	if (	(flags = fcntl(pm->input, F_GETFL)) == -1 ||
+		fcntl(pm->input, F_SETFL, flags & ~O_NONBLOCK) == -1
+	) goto error;
+
+	reader->fd = pm->input;
+	reader->transport = pm->transport;
+	reader->transport_data = pm->transport_data;
+	reader->pressed = reader->queued_pressed = pm->pressed != 0;
+
+	if ((reader->wakeup = eventfd(0, EFD_CLOEXEC)) == -1) goto error;
+
+	if ((pm->input = eventfd(0, EFD_CLOEXEC | (pm->nonblock ? EFD_NONBLOCK : 0))) == -1) {
+		pm->input = reader->fd;
+		close(reader->wakeup);
+		goto error;
+	}
+
+	pm->reader = reader;
+	pm->transport = &powermate_reader_transport;
+	pm->transport_data = reader;
+
+	if ((error = pthread_create(&reader->thread, NULL, powermate_reader_main, pm))) {
+		close(reader->wakeup);
+		close(pm->input);
+		pm->input = reader->fd;
+		pm->transport = reader->transport;
+		pm->transport_data = reader->transport_data;
+		pm->reader = NULL;
+		errno = error;
+		goto error;
+	}
+
+	return 0;
+
+	error:
+	error = errno;
+	free(reader->ring);
+	free(reader);
+	errno = error;
+	return -1;
+}
+
+
+/* Stops the thread and gives the device its input back. Events still
+in the ring are discarded. */
+
+int powermate_stop_reader(PowerMate *pm)
+{
+	if (pm->reader == NULL) return 0;
+
+	if (pm->loop != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	return powermate_reader_halt(pm);
+}
+
+
+/* powermate-reader.c EOF */
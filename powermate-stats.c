@@ -0,0 +1,185 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+
+#include "powermate-private.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SUB_BITS    POWERMATE_HISTOGRAM_SUB_BITS
+#define SUB_BUCKETS (1 << POWERMATE_HISTOGRAM_SUB_BITS)
+
+
+/*	Histograms are log-linear, as HDR histograms: values below
+	SUB_BUCKETS get a bucket each, and every power of 2 above is split
+	in SUB_BUCKETS linear buckets. Memory is fixed and recording takes
+	a bit scan and an increment.					*/
+
+static unsigned int powermate_histogram_bucket(unsigned long long int value)
+{
+	unsigned int magnitude;
+
+	if (value < SUB_BUCKETS) return (unsigned int)value;
+	magnitude = 63 - (unsigned int)__builtin_clzll(value);
+	if (magnitude >= SUB_BITS + POWERMATE_HISTOGRAM_MAGNITUDES) return POWERMATE_HISTOGRAM_BUCKETS - 1;
+
+	return	((magnitude - SUB_BITS + 1) << SUB_BITS)
+		| (unsigned int)((value >> (magnitude - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+
+/* Highest value counted in a bucket */
+
+static unsigned long long int powermate_histogram_top(unsigned int bucket)
+{
+	unsigned int magnitude = bucket >> SUB_BITS;
+
+	if (!magnitude) return bucket;
+
+	return	((unsigned long long int)(SUB_BUCKETS | (bucket & (SUB_BUCKETS - 1))) << (magnitude - 1))
+		+ (1ULL << (magnitude - 1)) - 1;
+}
+
+
+void powermate_histogram_add(PowerMateHistogram *histogram, unsigned long long int value)
+{
+	if (!histogram->count || value < histogram->min) histogram->min = value;
+	if (value > histogram->max) histogram->max = value;
+	histogram->count++;
+	histogram->sum += value;
+	histogram->buckets[powermate_histogram_bucket(value)]++;
+}
+
+
+/* Value below which percentile % of the samples fall, within the
+precision of the buckets. Returns 0 for an empty histogram. */
+
+unsigned long long int powermate_histogram_percentile(PowerMateHistogram *histogram, double percentile)
+{
+	unsigned long long int rank, seen = 0, top;
+	unsigned int bucket;
+	double exact;
+
+	if (!histogram->count) return 0;
+	if (percentile >= 100) return histogram->max;
+
+	/* Nearest rank: the ceiling of count * percentile / 100, at least 1 */
+
+	exact = histogram->count * percentile / 100;
+	if ((rank = (unsigned long long int)exact) < exact || !rank) rank++;
+
+	for (bucket = 0; bucket < POWERMATE_HISTOGRAM_BUCKETS; bucket++)
+		if ((seen += histogram->buckets[bucket]) >= rank) {
+			top = powermate_histogram_top(bucket);
+			return top < histogram->max ? top : histogram->max;
+		}
+
+	return histogram->max;
+}
+
+
+/* Statistics are kept only while enabled, enabling them again
+starts from zero. Without them every event costs a NULL check. */
+
+int powermate_set_stats(PowerMate *pm, int enabled)
+{
+	if (!enabled) {
+		free(pm->stats);
+		pm->stats = NULL;
+		return 0;
+	}
+
+	if (pm->stats == NULL && (pm->stats = (PowerMateStats *)malloc(sizeof(PowerMateStats))) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memset(pm->stats, 0, sizeof(PowerMateStats));
+	return 0;
+}
+
+
+/* Copies a snapshot of the statistics, fails with ENOENT if they
+are disabled */
+
+int powermate_get_stats(PowerMate *pm, PowerMateStats *stats)
+{
+	if (pm->stats == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	memcpy(stats, pm->stats, sizeof(PowerMateStats));
+	return 0;
+}
+
+
+/* Accounts an event about to be dispatched. Its latency is measured
+against the clock the kernel stamped it with, events from the future
+(a different clock, replays) count as 0. */
+
+void powermate_stats_event(PowerMate *pm, struct pm_event *event)
+{
+	PowerMateStats *stats = pm->stats;
+	PowerMateEventCount *entry;
+	struct timespec ts;
+	long long int latency;
+	unsigned int index;
+
+	stats->events++;
+	clock_gettime(pm->clock, &ts);
+
+	latency =
+		((long long int)ts.tv_sec - event->a) * 1000000000
+		+ ts.tv_nsec - (long long int)event->b * 1000;
+
+	powermate_histogram_add(&stats->latency, latency > 0 ? (unsigned long long int)latency : 0);
+
+	/* A PowerMate only sends a handful of codes, unused slots
+	are the ones with no count */
+
+	for (index = 0; index < POWERMATE_STATS_CODES; index++) {
+		entry = stats->codes + index;
+
+		if (!entry->count) {
+			entry->type = (unsigned short)event->type;
+			entry->code = (unsigned short)event->code;
+			entry->count = 1;
+			return;
+		}
+
+		if (entry->type == (unsigned short)event->type && entry->code == (unsigned short)event->code) {
+			entry->count++;
+			return;
+		}
+	}
+
+	stats->other++;
+}
+
+
+/* powermate-stats.c EOF */
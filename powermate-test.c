@@ -22,7 +22,10 @@
 
 
 #include <powermate.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -152,6 +155,9 @@ int main(int argc, char **argv)
 	if (pm->output != -1) {
 		struct termio iop;
 
+		/* Knob driven modes update the LED on every rotation event */
+		powermate_set_led_rate(pm, 25);
+
 		puts(	" ok, read and write allowed\n"
 			"Setting initial LED values to:\n"
 			"static_brightness = 255\n"
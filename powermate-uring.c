@@ -0,0 +1,680 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+
+#include "powermate-private.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* IORING_OP_READ_MULTISHOT, missing from older kernel headers */
+#define POWERMATE_URING_READ_MULTISHOT 49
+
+#define BUFFER_SIZE (POWERMATE_BUFFER_EVENTS * sizeof(struct pm_event))
+
+/* Completion kinds, stored in the low bits of user_data along with
+the slot index (14 bits), the write buffer of LED writes (16 bits up)
+and the slot generation (32 bits up) */
+#define URING_READ   0
+#define URING_WRITE  1
+#define URING_CANCEL 2
+
+#define USER_DATA(slot, generation, kind) \
+	(((unsigned long long int)(generation) << 32) | ((slot) << 2) | (kind))
+
+#define WRITE_DATA(slot, generation, write) \
+	(USER_DATA(slot, generation, URING_WRITE) | ((unsigned long long int)(write) << 16))
+
+#define DATA_SLOT(data)	 ((unsigned int)((data) & 0xFFFF) >> 2)
+#define DATA_WRITE(data) ((unsigned int)((data) >> 16) & 0xFFFF)
+
+#define WRITES_BUSY ((1U << POWERMATE_URING_WRITES) - 1)
+
+
+/*	io_uring backend
+
+	Every device keeps a read posted, multishot where the kernel
+	supports it, filling buffers provided to the kernel in a ring. A
+	dispatch submits what was queued (new reads, LED writes) and waits
+	for completions with a single io_uring_enter(), then hands every
+	filled buffer to powermate_get_events() through a transport which
+	reads from it. LED writes made from the handlers are queued too,
+	and go out with the next dispatch or powermate_uring_submit().
+
+	liburing is not used, the rings are set up with the raw system
+	calls.								*/
+
+
+/* Submits the queued entries and waits for wait completions to be in
+the ring (0 does not wait) */
+
+static int powermate_uring_enter(PowerMateUring *uring, unsigned int wait, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int retval;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (long long int)(timeout % 1000) * 1000000;
+		arg.ts = (unsigned long long int)(uintptr_t)&ts;
+	}
+
+	uring->enters++;
+
+	if ((retval = (int)syscall(
+		__NR_io_uring_enter, uring->fd, uring->queued, wait,
+		wait ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0,
+		wait ? &arg : NULL, sizeof(arg)
+	)) == -1) return errno == ETIME || errno == EINTR ? 0 : -1;
+
+	uring->queued -= (unsigned int)retval;
+	return 0;
+}
+
+
+/* Returns a cleared submission entry, submitting the queued ones first
+if the ring is full */
+
+static struct io_uring_sqe *powermate_uring_get_sqe(PowerMateUring *uring)
+{
+	unsigned int tail = *uring->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (	tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) > uring->sq_mask &&
+		(powermate_uring_enter(uring, 0, 0) ||
+		tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) > uring->sq_mask)
+	) {
+		errno = EBUSY;
+		return NULL;
+	}
+
+	sqe = (struct io_uring_sqe *)uring->sqes + (tail & uring->sq_mask);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+
+static void powermate_uring_queue(PowerMateUring *uring)
+{
+	__atomic_store_n(uring->sq_tail, *uring->sq_tail + 1, __ATOMIC_RELEASE);
+	uring->queued++;
+}
+
+
+static void powermate_uring_recycle(PowerMateUring *uring, unsigned int buffer)
+{
+	struct io_uring_buf_ring *ring = (struct io_uring_buf_ring *)uring->buffer_ring;
+	struct io_uring_buf *entry = &ring->bufs[uring->buffer_tail & (uring->buffer_count - 1)];
+
+	entry->addr = (unsigned long long int)(uintptr_t)(uring->buffers + (size_t)buffer * BUFFER_SIZE);
+	entry->len = BUFFER_SIZE;
+	entry->bid = (unsigned short)buffer;
+	__atomic_store_n(&ring->tail, (unsigned short)++uring->buffer_tail, __ATOMIC_RELEASE);
+}
+
+
+static int powermate_uring_arm(PowerMateUring *uring, unsigned int index)
+{
+	PowerMateUringSlot *slot = uring->slots + index;
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = powermate_uring_get_sqe(uring)) == NULL) return -1;
+	sqe->opcode = uring->multishot ? POWERMATE_URING_READ_MULTISHOT : IORING_OP_READ;
+	sqe->fd = slot->pm->input;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->off = (unsigned long long int)-1;
+	sqe->len = uring->multishot ? 0 : BUFFER_SIZE;
+	sqe->user_data = USER_DATA(index, slot->generation, URING_READ);
+	powermate_uring_queue(uring);
+	slot->armed = 1;
+	return 0;
+}
+
+
+/* Transport of the registered devices: reads come from the buffer
+being dispatched, LED writes are queued in the ring */
+
+static ssize_t powermate_uring_read(PowerMate *pm, void *buffer, size_t size)
+{
+	PowerMateUringSlot *slot = (PowerMateUringSlot *)pm->transport_data;
+	char *data;
+
+	if (slot->buffer == -1) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	data = slot->uring->buffers + (size_t)slot->buffer * BUFFER_SIZE;
+	if (size > slot->end - slot->begin) size = slot->end - slot->begin;
+	memcpy(buffer, data + slot->begin, size);
+
+	if ((slot->begin += size) == slot->end) {
+		powermate_uring_recycle(slot->uring, (unsigned int)slot->buffer);
+		slot->buffer = -1;
+	}
+
+	return (ssize_t)size;
+}
+
+
+static ssize_t powermate_uring_write(PowerMate *pm, const void *buffer, size_t size)
+{
+	PowerMateUringSlot *slot = (PowerMateUringSlot *)pm->transport_data;
+	PowerMateUring *uring = slot->uring;
+	struct io_uring_sqe *sqe;
+	struct pm_event *event;
+	unsigned int write;
+	ssize_t retval;
+
+	/* Every buffer in flight, written right now */
+
+	if (	size != sizeof(struct pm_event) ||
+		slot->writes_busy == WRITES_BUSY ||
+		(sqe = powermate_uring_get_sqe(uring)) == NULL
+	) {
+		pm->transport_data = slot->transport_data;
+		retval = slot->transport->write(pm, buffer, size);
+		pm->transport_data = slot;
+		return retval;
+	}
+
+	/* Completions come in any order, a buffer is only reused
+	once its own write has completed */
+
+	for (write = 0; slot->writes_busy & (1U << write); write++);
+	slot->writes_busy |= 1U << write;
+	slot->writes_in_flight++;
+	event = slot->writes + write;
+	memcpy(event, buffer, size);
+
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = pm->output;
+	sqe->addr = (unsigned long long int)(uintptr_t)event;
+	sqe->len = (unsigned int)size;
+	sqe->off = (unsigned long long int)-1;
+	sqe->user_data = WRITE_DATA((unsigned int)(slot - uring->slots), slot->generation, write);
+	powermate_uring_queue(uring);
+	return (ssize_t)size;
+}
+
+
+static const char *powermate_uring_identify(PowerMate *pm)
+{
+	return pm->model_id;
+}
+
+
+static int powermate_uring_close(PowerMate *pm)
+{
+	PowerMateUringSlot *slot = (PowerMateUringSlot *)pm->transport_data;
+
+	powermate_uring_remove(slot->uring, pm);
+	return pm->transport->close(pm);
+}
+
+
+static const PowerMateTransport powermate_uring_transport = {
+	NULL,
+	powermate_uring_read,
+	powermate_uring_write,
+	powermate_uring_identify,
+	powermate_uring_close
+};
+
+
+/* devices is the maximum number of devices registered at once */
+
+PowerMateUring *powermate_uring_new(unsigned int devices)
+{
+	PowerMateUring *uring;
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	unsigned int index, entries = 16;
+	char *ring;
+	int error;
+
+	if (!devices || devices > 16384) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((uring = (PowerMateUring *)calloc(1, sizeof(PowerMateUring))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	uring->fd = -1;
+	uring->multishot = 1;
+	uring->size = devices;
+	while (entries < devices * 2) entries *= 2;
+	uring->buffer_count = entries;
+
+	if (	(uring->slots = (PowerMateUringSlot *)calloc(devices, sizeof(PowerMateUringSlot))) == NULL ||
+		(uring->buffers = (char *)malloc((size_t)uring->buffer_count * BUFFER_SIZE)) == NULL
+	) {
+		error = ENOMEM;
+		goto error;
+	}
+
+	/* Multishot reads may complete many times each */
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4;
+
+	if ((uring->fd = (int)syscall(__NR_io_uring_setup, entries, &params)) == -1) {
+		error = errno;
+		goto error;
+	}
+
+	if (	!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+		!(params.features & IORING_FEAT_EXT_ARG)
+	) {
+		error = ENOSYS;
+		goto error;
+	}
+
+	uring->ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+
+	if (uring->ring_size < params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe))
+		uring->ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->buffer_ring_size = (uring->buffer_count * sizeof(struct io_uring_buf) + 4095) & ~(size_t)4095;
+
+	if ((uring->sq_ring = mmap(
+		NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING
+	)) == MAP_FAILED) {
+		uring->sq_ring = NULL;
+		error = errno;
+		goto error;
+	}
+
+	if ((uring->sqes = mmap(
+		NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES
+	)) == MAP_FAILED) {
+		uring->sqes = NULL;
+		error = errno;
+		goto error;
+	}
+
+	ring = (char *)uring->sq_ring;
+	uring->sq_head = (unsigned int *)(ring + params.sq_off.head);
+	uring->sq_tail = (unsigned int *)(ring + params.sq_off.tail);
+	uring->sq_array = (unsigned int *)(ring + params.sq_off.array);
+	uring->sq_mask = *(unsigned int *)(ring + params.sq_off.ring_mask);
+	uring->cq_head = (unsigned int *)(ring + params.cq_off.head);
+	uring->cq_tail = (unsigned int *)(ring + params.cq_off.tail);
+	uring->cqes = ring + params.cq_off.cqes;
+	uring->cq_mask = *(unsigned int *)(ring + params.cq_off.ring_mask);
+
+	/* Submission entries are used in order, the indirection
+	array is set once */
+
+	for (index = 0; index <= uring->sq_mask; index++) uring->sq_array[index] = index;
+
+	if ((uring->buffer_ring = mmap(
+		NULL, uring->buffer_ring_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+	)) == MAP_FAILED) {
+		uring->buffer_ring = NULL;
+		error = errno;
+		goto error;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long int)(uintptr_t)uring->buffer_ring;
+	reg.ring_entries = uring->buffer_count;
+	reg.bgid = 0;
+
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		error = errno;
+		goto error;
+	}
+
+	for (index = 0; index < uring->buffer_count; index++) powermate_uring_recycle(uring, index);
+	return uring;
+
+	error:
+	powermate_uring_destroy(uring);
+	errno = error;
+	return NULL;
+}
+
+
+/* Registered devices are removed, not destroyed */
+
+int powermate_uring_destroy(PowerMateUring *uring)
+{
+	unsigned int index;
+
+	for (index = 0; index < uring->size && uring->count; index++)
+		if (uring->slots[index].pm != NULL) powermate_uring_remove(uring, uring->slots[index].pm);
+
+	if (uring->fd > -1) close(uring->fd);
+	if (uring->buffer_ring != NULL) munmap(uring->buffer_ring, uring->buffer_ring_size);
+	if (uring->sqes != NULL) munmap(uring->sqes, uring->sqes_size);
+	if (uring->sq_ring != NULL) munmap(uring->sq_ring, uring->ring_size);
+	free(uring->buffers);
+	free(uring->slots);
+	free(uring);
+	return 0;
+}
+
+
+/* Only evdev devices (or descriptors wrapped with powermate_new_from_fd())
+can be registered, and not while in a PowerMateLoop */
+
+int powermate_uring_add(PowerMateUring *uring, PowerMate *pm)
+{
+	PowerMateUringSlot *slot;
+	unsigned int index;
+
+	if (pm->transport != &powermate_evdev_transport || pm->input < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pm->loop != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (uring->count == uring->size) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	for (index = 0; uring->slots[index].pm != NULL; index++);
+	slot = uring->slots + index;
+	slot->pm = pm;
+	slot->uring = uring;
+	slot->buffer = -1;
+	slot->writes_busy = 0;
+	slot->writes_in_flight = 0;
+
+	if (powermate_uring_arm(uring, index)) {
+		slot->pm = NULL;
+		return -1;
+	}
+
+	slot->transport = pm->transport;
+	slot->transport_data = pm->transport_data;
+	pm->transport = &powermate_uring_transport;
+	pm->transport_data = slot;
+
+	/* The read is posted, the device must never wait on its input */
+
+	pm->nonblock = 1;
+	uring->count++;
+	return 0;
+}
+
+
+/* Marks the LED write completions of a slot found in the ring */
+
+static void powermate_uring_reap_writes(PowerMateUring *uring, unsigned int index)
+{
+	struct io_uring_cqe *cqe, *cqes = (struct io_uring_cqe *)uring->cqes;
+	PowerMateUringSlot *slot = uring->slots + index;
+	unsigned int head, tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (head = *uring->cq_head; head != tail; head++) {
+		cqe = cqes + (head & uring->cq_mask);
+
+		if (	(cqe->user_data & 3) == URING_WRITE &&
+			DATA_SLOT(cqe->user_data) == index &&
+			(unsigned int)(cqe->user_data >> 32) == slot->generation &&
+			slot->writes_busy & (1U << DATA_WRITE(cqe->user_data))
+		) {
+			slot->writes_busy &= ~(1U << DATA_WRITE(cqe->user_data));
+			slot->writes_in_flight--;
+			uring->completions++;
+			if (cqe->res < 0) uring->write_errors++;
+		}
+	}
+}
+
+
+/* Waits for the LED writes of a slot still in flight, which would
+otherwise reach a descriptor closed or reused once the device is gone.
+Their completions are left in the ring, dispatch finds them stale. */
+
+static void powermate_uring_settle_writes(PowerMateUring *uring, unsigned int index)
+{
+	PowerMateUringSlot *slot = uring->slots + index;
+
+	if (uring->queued) powermate_uring_enter(uring, 0, 0);
+
+	for (;;) {
+		powermate_uring_reap_writes(uring, index);
+		if (!slot->writes_busy) return;
+
+		if (powermate_uring_enter(
+			uring, __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE) - *uring->cq_head + 1, 100
+		)) return;
+	}
+}
+
+
+int powermate_uring_remove(PowerMateUring *uring, PowerMate *pm)
+{
+	PowerMateUringSlot *slot = (PowerMateUringSlot *)pm->transport_data;
+	unsigned int index = (unsigned int)(slot - uring->slots);
+	struct io_uring_sqe *sqe;
+
+	if (pm->transport != &powermate_uring_transport || slot->uring != uring) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Completions of the cancelled read and of the settled
+	writes are recognized as stale by the new generation */
+
+	if (slot->armed && (sqe = powermate_uring_get_sqe(uring)) != NULL) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = USER_DATA(index, slot->generation, URING_READ);
+		sqe->user_data = USER_DATA(index, slot->generation, URING_CANCEL);
+		powermate_uring_queue(uring);
+		powermate_uring_enter(uring, 0, 0);
+	}
+
+	if (slot->writes_busy) powermate_uring_settle_writes(uring, index);
+	if (!slot->armed) uring->disarmed--;
+	if (slot->buffer != -1) powermate_uring_recycle(uring, (unsigned int)slot->buffer);
+	slot->generation++;
+	slot->armed = 0;
+	slot->buffer = -1;
+	slot->pm = NULL;
+
+	pm->transport = slot->transport;
+	pm->transport_data = slot->transport_data;
+	pm->nonblock = (pm->flags & POWERMATE_OPEN_NONBLOCK) != 0;
+	if (uring->pending == pm) uring->pending = NULL;
+	uring->count--;
+	return 0;
+}
+
+
+/* Submits the queued reads and LED writes without waiting */
+
+int powermate_uring_submit(PowerMateUring *uring)
+{
+	return uring->queued ? powermate_uring_enter(uring, 0, 0) : 0;
+}
+
+
+/* Ring a device is registered in, NULL if none */
+
+PowerMateUring *powermate_uring_of(PowerMate *pm)
+{
+	return pm->transport == &powermate_uring_transport ? ((PowerMateUringSlot *)pm->transport_data)->uring : NULL;
+}
+
+
+/* Dispatches the buffered events of a device, a handler stopping the
+dispatch leaves it pending */
+
+static int powermate_uring_drain(PowerMateUring *uring, PowerMate *pm)
+{
+	PowerMateUringSlot *slot = (PowerMateUringSlot *)pm->transport_data;
+	int retval = powermate_get_events(pm);
+
+	if (retval == -1) {
+		if (errno == EAGAIN) return 0;
+		return -1;
+	}
+
+	if (pm->buffer_end != pm->buffer_begin || slot->buffer != -1) uring->pending = pm;
+	return retval;
+}
+
+
+/* Waits up to timeout milliseconds (-1 forever) for completions and
+dispatches them. A device whose read fails or reaches the end is
+removed and reported through uring->failed. */
+
+int powermate_uring_dispatch(PowerMateUring *uring, int timeout)
+{
+	struct io_uring_cqe *cqe, *cqes = (struct io_uring_cqe *)uring->cqes;
+	PowerMateUringSlot *slot;
+	unsigned int head, index;
+	int retval, kind, buffer, error;
+	PowerMate *pm;
+
+	if ((pm = uring->pending) != NULL) {
+		uring->pending = NULL;
+		if ((retval = powermate_uring_drain(uring, pm))) return retval;
+	}
+
+	/* Reads ended by the kernel (no buffers left, single reads)
+	are posted again with the same io_uring_enter() that waits */
+
+	for (index = 0; uring->disarmed && index < uring->size; index++)
+		if (	uring->slots[index].pm != NULL && !uring->slots[index].armed &&
+			!powermate_uring_arm(uring, index)
+		) uring->disarmed--;
+
+	head = *uring->cq_head;
+
+	if (	head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)
+		? powermate_uring_enter(uring, 1, timeout)
+		: powermate_uring_submit(uring)
+	) return -1;
+
+	while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = cqes + (head & uring->cq_mask);
+		kind = (int)(cqe->user_data & 3);
+		index = DATA_SLOT(cqe->user_data);
+		slot = uring->slots + index;
+		buffer = cqe->flags & IORING_CQE_F_BUFFER ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+		if (slot->pm == NULL || slot->generation != (unsigned int)(cqe->user_data >> 32)) {
+			if (buffer != -1) powermate_uring_recycle(uring, (unsigned int)buffer);
+			__atomic_store_n(uring->cq_head, ++head, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		/* The previous buffer of the device is still being
+		dispatched, this one waits in the ring */
+
+		if (kind == URING_READ && slot->buffer != -1 && cqe->res > 0) break;
+
+		pm = slot->pm;
+		retval = cqe->res;
+		__atomic_store_n(uring->cq_head, ++head, __ATOMIC_RELEASE);
+		uring->completions++;
+
+		if (kind == URING_WRITE) {
+			slot->writes_busy &= ~(1U << DATA_WRITE(cqe->user_data));
+			slot->writes_in_flight--;
+			if (retval < 0) uring->write_errors++;
+			continue;
+		}
+
+		if (kind != URING_READ) continue;
+
+		if (!(cqe->flags & IORING_CQE_F_MORE)) {
+			slot->armed = 0;
+			uring->disarmed++;
+		}
+
+		if (retval > 0) {
+			slot->buffer = buffer;
+			slot->begin = 0;
+			slot->end = (size_t)retval;
+			if ((retval = powermate_uring_drain(uring, pm))) return retval;
+			continue;
+		}
+
+		if (buffer != -1) powermate_uring_recycle(uring, (unsigned int)buffer);
+
+		/* Kernels without multishot reads reject them, the
+		device is posted single reads from now on */
+
+		if (retval == -EINVAL && uring->multishot) {
+			uring->multishot = 0;
+			continue;
+		}
+
+		if (	retval == -ENOBUFS || retval == -EAGAIN ||
+			retval == -EINTR || retval == -ECANCELED
+		) continue;
+
+		error = retval ? -retval : ENODEV;
+		powermate_uring_remove(uring, pm);
+		uring->failed = pm;
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int powermate_uring_run(PowerMateUring *uring)
+{
+	int retval;
+
+	while (!(retval = powermate_uring_dispatch(uring, -1)));
+	return retval;
+}
+
+
+/* powermate-uring.c EOF */
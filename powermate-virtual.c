@@ -0,0 +1,350 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "powermate.h"
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* In-memory transport: events injected by the caller are kept in a ring
+and read back without system calls. An eventfd, readable while the ring
+holds events, is used as input so that the device works in PowerMateLoop
+too; reading an empty ring fails with EAGAIN instead of blocking. */
+
+static int powermate_memory_open(PowerMate *pm, void *argument)
+{
+	PowerMateMemory *memory = (PowerMateMemory *)calloc(1, sizeof(PowerMateMemory));
+
+	(void)argument;
+
+	if (memory == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if ((memory->ring = (struct pm_event *)malloc(
+		POWERMATE_MEMORY_EVENTS * sizeof(struct pm_event))) == NULL
+	) {
+		free(memory);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if ((pm->input = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		int error = errno;
+
+		free(memory->ring);
+		free(memory);
+		errno = error;
+		return -1;
+	}
+
+	pm->output = pm->input;
+	pm->nonblock = 1;
+	pm->transport_data = memory;
+	return 0;
+}
+
+
+static ssize_t powermate_memory_read(PowerMate *pm, void *buffer, size_t size)
+{
+	PowerMateMemory *memory = (PowerMateMemory *)pm->transport_data;
+	struct pm_event *events = (struct pm_event *)buffer;
+	unsigned long long int value;
+	size_t count = 0;
+
+	if (memory->head == memory->tail) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	/* The eventfd is cleared before draining the ring, so that a
+	failure leaves the events where they were */
+
+	if (memory->head - memory->tail <= size / sizeof(struct pm_event))
+		while (read(pm->input, &value, sizeof(value)) == -1)
+			if (errno != EINTR) {
+				if (errno == EAGAIN) break;
+				return -1;
+			}
+
+	while (count < size / sizeof(struct pm_event) && memory->tail != memory->head)
+		events[count++] = memory->ring[memory->tail++ % POWERMATE_MEMORY_EVENTS];
+
+	return (ssize_t)(count * sizeof(struct pm_event));
+}
+
+
+/* LED words are kept for the caller to check */
+
+static ssize_t powermate_memory_write(PowerMate *pm, const void *buffer, size_t size)
+{
+	PowerMateMemory *memory = (PowerMateMemory *)pm->transport_data;
+	const struct pm_event *event = (const struct pm_event *)buffer;
+
+	if (size < sizeof(struct pm_event)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memory->led = event->data;
+	memory->led_writes++;
+	return (ssize_t)size;
+}
+
+
+static const char *powermate_memory_identify(PowerMate *pm)
+{
+	(void)pm;
+	return "Griffin PowerMate";
+}
+
+
+static int powermate_memory_close(PowerMate *pm)
+{
+	PowerMateMemory *memory = (PowerMateMemory *)pm->transport_data;
+
+	close(pm->input);
+	free(memory->ring);
+	free(memory);
+	return 0;
+}
+
+
+const PowerMateTransport powermate_memory_transport = {
+	powermate_memory_open,
+	powermate_memory_read,
+	powermate_memory_write,
+	powermate_memory_identify,
+	powermate_memory_close
+};
+
+
+PowerMate *powermate_new_memory(PowerMateHandlers *handlers)
+{
+	return powermate_new_transport(&powermate_memory_transport, NULL, handlers);
+}
+
+
+/* Queues events for an in-memory device. Returns how many of them fit
+in the ring, or -1 if the device could not be signalled (nothing is
+queued then). The event filter is applied as evdev does: filtered events
+are dropped and so are the SYN_REPORT closing frames left empty. */
+
+int powermate_memory_inject(PowerMate *pm, const struct pm_event *events, unsigned int count)
+{
+	PowerMateMemory *memory = (PowerMateMemory *)pm->transport_data;
+	unsigned long long int one = 1;
+	unsigned int index, empty = memory->head == memory->tail;
+	unsigned int head = memory->head, frame = memory->frame;
+
+	for (index = 0; index < count && memory->head - memory->tail < POWERMATE_MEMORY_EVENTS; index++) {
+		if (pm->filter.enabled) {
+			if (	(unsigned short)events[index].type < 32 &&
+				!(pm->filter.types & (1U << events[index].type))
+			) continue;
+
+			if (events[index].type == EV_SYN && events[index].code == SYN_REPORT) {
+				if (!memory->frame) {
+					pm->filter.avoided++;
+					continue;
+				}
+
+				memory->frame = 0;
+
+			} else memory->frame++;
+		}
+
+		memory->ring[memory->head++ % POWERMATE_MEMORY_EVENTS] = events[index];
+	}
+
+	if (empty && memory->head != memory->tail)
+		while (write(pm->input, &one, sizeof(one)) == -1)
+			if (errno != EINTR) {
+				memory->head = head;
+				memory->frame = frame;
+				return -1;
+			}
+
+	return (int)index;
+}
+
+
+/*	Virtual PowerMate (uinput)
+
+	A kernel input device announcing itself as a Griffin PowerMate:
+	same name, USB IDs and capabilities (REL_DIAL, BTN_0 and
+	MSC_PULSELED). Its event node is opened as any real knob with
+	powermate_new(), events are injected with the functions below and
+	the LED words written by the library are read back from uinput.	*/
+
+
+static int powermate_virtual_emit(PowerMateVirtual *virtual, unsigned short type, unsigned short code, int value)
+{
+	struct input_event e[2];
+
+	memset(e, 0, sizeof(e));
+	e[0].type = type;
+	e[0].code = code;
+	e[0].value = value;
+	e[1].type = EV_SYN;
+	e[1].code = SYN_REPORT;
+	ssize_t size;
+
+	while ((size = write(virtual->fd, e, sizeof(e))) == -1)
+		if (errno != EINTR) return -1;
+
+	if (size != sizeof(e)) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Finds the event node of the uinput device through sysfs */
+
+static int powermate_virtual_find_node(PowerMateVirtual *virtual)
+{
+	char sysname[64], path[128];
+	struct dirent *entry;
+	DIR *dir;
+
+	if (ioctl(virtual->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) return -1;
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	if ((dir = opendir(path)) == NULL) return -1;
+
+	while ((entry = readdir(dir)) != NULL) if (!strncmp(entry->d_name, "event", 5)) {
+		snprintf(virtual->device, sizeof(virtual->device), "/dev/input/%.100s", entry->d_name);
+		closedir(dir);
+		return 0;
+	}
+
+	closedir(dir);
+	errno = ENOENT;
+	return -1;
+}
+
+
+PowerMateVirtual *powermate_virtual_new(void)
+{
+	PowerMateVirtual *virtual = (PowerMateVirtual *)calloc(1, sizeof(PowerMateVirtual));
+	struct uinput_setup setup;
+
+	if (virtual == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((virtual->fd = open("/dev/uinput", O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		free(virtual);
+		return NULL;
+	}
+
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = BUS_USB;
+	setup.id.vendor = 0x077D;
+	setup.id.product = 0x0410;
+	strcpy(setup.name, "Griffin PowerMate");
+
+	if (	ioctl(virtual->fd, UI_SET_EVBIT, EV_REL) < 0 ||
+		ioctl(virtual->fd, UI_SET_RELBIT, REL_DIAL) < 0 ||
+		ioctl(virtual->fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+		ioctl(virtual->fd, UI_SET_KEYBIT, BTN_0) < 0 ||
+		ioctl(virtual->fd, UI_SET_EVBIT, EV_MSC) < 0 ||
+		ioctl(virtual->fd, UI_SET_MSCBIT, MSC_PULSELED) < 0 ||
+		ioctl(virtual->fd, UI_DEV_SETUP, &setup) < 0 ||
+		ioctl(virtual->fd, UI_DEV_CREATE) < 0 ||
+		powermate_virtual_find_node(virtual)
+	) {
+		int error = errno;
+
+		powermate_virtual_destroy(virtual);
+		errno = error;
+		return NULL;
+	}
+
+	return virtual;
+}
+
+
+int powermate_virtual_destroy(PowerMateVirtual *virtual)
+{
+	ioctl(virtual->fd, UI_DEV_DESTROY);
+	close(virtual->fd);
+	free(virtual);
+	return 0;
+}
+
+
+int powermate_virtual_rotate(PowerMateVirtual *virtual, int units)
+{
+	return powermate_virtual_emit(virtual, EV_REL, REL_DIAL, units);
+}
+
+
+int powermate_virtual_button(PowerMateVirtual *virtual, int pressed)
+{
+	return powermate_virtual_emit(virtual, EV_KEY, BTN_0, pressed ? 1 : 0);
+}
+
+
+/* Returns 1 and the last LED word written to the device, or 0 if none
+was written since the previous call, -1 on errors */
+
+int powermate_virtual_get_led(PowerMateVirtual *virtual, unsigned int *word)
+{
+	struct input_event e;
+	ssize_t size;
+	int found = 0;
+
+	while ((size = read(virtual->fd, &e, sizeof(e))) == sizeof(e) || (size == -1 && errno == EINTR))
+		if (size != -1 && e.type == EV_MSC && e.code == MSC_PULSELED) {
+			*word = (unsigned int)e.value;
+			found = 1;
+		}
+
+	if (size == -1 && errno != EAGAIN) return -1;
+
+	if (size != -1 && size != 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	return found;
+}
+
+
+/* powermate-virtual.c EOF */
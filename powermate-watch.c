@@ -0,0 +1,261 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "powermate.h"
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define POWERMATE_WATCH_MASK \
+	(IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+
+PowerMateWatch *powermate_watch_new(
+	const char *directory,
+	int flags,
+	PowerMateWatchFunc added,
+	PowerMateWatchFunc removed,
+	void *data
+){
+	PowerMateWatch *watch = (PowerMateWatch *)calloc(1, sizeof(PowerMateWatch));
+	size_t size;
+
+	if (watch == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (directory == NULL) directory = "/dev/input";
+	size = strlen(directory);
+
+	/* Room for the path of any node inside the directory */
+
+	if (	(watch->directory = (char *)malloc(size + NAME_MAX + 2)) == NULL ||
+		(watch->buffer = (char *)malloc(POWERMATE_WATCH_BUFFER_SIZE)) == NULL
+	) {
+		free(watch->directory);
+		free(watch);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	strcpy(watch->directory, directory);
+	if (size && directory[size - 1] != '/') watch->directory[size++] = '/';
+	watch->directory[size] = 0;
+	watch->length = size;
+	watch->flags = flags;
+	watch->added = added;
+	watch->removed = removed;
+	watch->data = data;
+
+	if (	(watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ||
+		inotify_add_watch(watch->fd, directory, POWERMATE_WATCH_MASK) == -1
+	) {
+		int error = errno;
+
+		powermate_watch_destroy(watch);
+		errno = error;
+		return NULL;
+	}
+
+	return watch;
+}
+
+
+int powermate_watch_destroy(PowerMateWatch *watch)
+{
+	if (watch->fd > -1) close(watch->fd);
+	while (watch->count) free(watch->devices[--watch->count]);
+	free(watch->devices);
+	free(watch->directory);
+	free(watch->buffer);
+	free(watch);
+	return 0;
+}
+
+
+/* Builds the full path of a node of the watched directory */
+
+static char *powermate_watch_path(PowerMateWatch *watch, const char *name)
+{
+	strncpy(watch->directory + watch->length, name, NAME_MAX);
+	watch->directory[watch->length + NAME_MAX] = 0;
+	return watch->directory;
+}
+
+
+static int powermate_watch_find(PowerMateWatch *watch, const char *name)
+{
+	unsigned int index;
+
+	for (index = 0; index < watch->count; index++)
+		if (!strcmp(watch->devices[index], name)) return (int)index;
+	return -1;
+}
+
+
+/* Real nodes are identified by their model name. Stand-ins (FIFOs and
+sockets) are only accepted with POWERMATE_WATCH_ANY_NODE, and so is any
+character device, which is useful for testing. */
+
+static int powermate_watch_identify(PowerMateWatch *watch, const char *path)
+{
+	struct stat entry_stat;
+	const char *model;
+	int fd;
+
+	if (stat(path, &entry_stat)) return 0;
+
+	if (watch->flags & POWERMATE_WATCH_ANY_NODE) return
+		S_ISCHR(entry_stat.st_mode) ||
+		S_ISFIFO(entry_stat.st_mode) ||
+		S_ISSOCK(entry_stat.st_mode);
+
+	/* udev creates the node before granting access to it, the
+	IN_ATTRIB event that follows gives a second chance */
+
+	if (!S_ISCHR(entry_stat.st_mode) || (fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1)
+		return 0;
+
+	model = get_powermate_model(fd);
+	close(fd);
+	return model != NULL;
+}
+
+
+static int powermate_watch_check(PowerMateWatch *watch, const char *name)
+{
+	char **a, *copy;
+
+	if (	powermate_watch_find(watch, name) != -1 ||
+		!powermate_watch_identify(watch, powermate_watch_path(watch, name))
+	) return 0;
+
+	if (watch->count == watch->size) {
+		if ((a = (char **)realloc(
+			(void *)watch->devices,
+			(watch->size ? watch->size * 2 : 4) * sizeof(char *)
+		)) == NULL) return -1;
+
+		watch->devices = a;
+		watch->size = watch->size ? watch->size * 2 : 4;
+	}
+
+	if ((copy = strdup(name)) == NULL) return -1;
+	watch->devices[watch->count++] = copy;
+
+	return watch->added != NULL
+		? watch->added(watch, watch->data, powermate_watch_path(watch, name))
+		: 0;
+}
+
+
+static int powermate_watch_lose(PowerMateWatch *watch, unsigned int index)
+{
+	char *name = watch->devices[index];
+	int retval = 0;
+
+	watch->devices[index] = watch->devices[--watch->count];
+
+	if (watch->removed != NULL)
+		retval = watch->removed(watch, watch->data, powermate_watch_path(watch, name));
+
+	free(name);
+	return retval;
+}
+
+
+/* Brings the device set up to date with the directory contents. It
+must be called once after powermate_watch_new() to report the devices
+already present, and is called again if the inotify queue overflows. */
+
+int powermate_watch_scan(PowerMateWatch *watch)
+{
+	struct stat entry_stat;
+	struct dirent *entry;
+	unsigned int index;
+	DIR *dir;
+	int retval = 0;
+
+	for (index = watch->count; index--;) if (stat(
+		powermate_watch_path(watch, watch->devices[index]), &entry_stat
+	) && (retval = powermate_watch_lose(watch, index))) return retval;
+
+	watch->directory[watch->length] = 0;
+	if ((dir = opendir(watch->directory)) == NULL) return -1;
+
+	while ((entry = readdir(dir)) != NULL) if (
+		entry->d_name[0] != '.' &&
+		(retval = powermate_watch_check(watch, entry->d_name))
+	) break;
+
+	closedir(dir);
+	return retval;
+}
+
+
+/* Processes the queued inotify events. Events left when a callback
+returns non-zero are kept for the next call. Returns 0 once the queue
+is empty. */
+
+int powermate_watch_dispatch(PowerMateWatch *watch)
+{
+	struct inotify_event *event;
+	ssize_t size;
+	int index, retval;
+
+	for (;;) {
+		if (watch->begin == watch->end) {
+			if ((size = read(watch->fd, watch->buffer, POWERMATE_WATCH_BUFFER_SIZE)) <= 0)
+				return size && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+			watch->begin = 0;
+			watch->end = (size_t)size;
+		}
+
+		event = (struct inotify_event *)(watch->buffer + watch->begin);
+		watch->begin += sizeof(struct inotify_event) + event->len;
+
+		if (event->mask & IN_Q_OVERFLOW) retval = powermate_watch_scan(watch);
+		else if (!event->len || event->name[0] == '.') retval = 0;
+
+		else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+			retval = (index = powermate_watch_find(watch, event->name)) != -1
+				? powermate_watch_lose(watch, (unsigned int)index)
+				: 0;
+
+		else retval = powermate_watch_check(watch, event->name);
+
+		if (retval) return retval;
+	}
+}
+
+
+/* powermate-watch.c EOF */
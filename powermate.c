@@ -23,7 +23,7 @@
 */
 
 
-#include "powermate.h"
+#include "powermate-private.h"
 #include <linux/input.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -33,20 +33,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
 
 /* Uncoment the next line if you want to compile using -ansi */
 /* #include <linux/limits.h> */
 
 
-struct pm_event {
-	long a;
-	long b;
-	short type;
-	short code;
-	unsigned int data;
-};
-
-
 /* To be implemented in a future version */
 /*
 unsigned char check_powermate_support(void)
@@ -55,20 +49,60 @@ unsigned char check_powermate_support(void)
 */
 
 
+static const struct {
+	const char *name;
+	unsigned int vendor;
+	unsigned int product;
+} powermate_models[] = {
+	{"Griffin SoundKnob", 0x077D, 0x04AA},
+	{"Griffin PowerMate", 0x077D, 0x0410}
+};
+
+#define POWERMATE_MODELS (sizeof(powermate_models) / sizeof(powermate_models[0]))
+
+
+/* Appends a copy of path to the found devices array, which grows by
+doubling its capacity (the next power of 2 of count). */
+
+static int powermate_add_found(char ***found_devices, int count, const char *path)
+{
+	char **a, *copy;
+
+	if (!(count & (count - 1))) {
+		if ((a = (char **)realloc(
+			(void *)*found_devices, (count ? count * 2 : 1) * sizeof(char *)
+		)) == NULL) return -1;
+
+		*found_devices = a;
+	}
+
+	/* (char *) cast to avoid warning when compiling with -ansi gcc option */
+	if ((copy = (char *)strdup(path)) == NULL) return -1;
+	(*found_devices)[count] = copy;
+	return 0;
+}
+
+
 int search_powermate_devices(char *directory, char ***found_devices)
 {
-	int fd, count = 0;
+	int fd, count;
 	size_t size;
 	DIR* dir;
 	struct stat entry_stat;
-	char *default_directory = "/dev/input", **a;
-	union {	struct dirent entry;
-              	char b[offsetof(struct dirent, d_name) + NAME_MAX + 1];
-	} u;
-	struct dirent *result = &u.entry;
+	struct dirent *entry;
+	char *default_directory = "/dev/input";
 	char *path, *offset;
 
-	if (directory == NULL) directory = default_directory;
+	/* The default directory can be resolved through sysfs
+	without opening every node in it */
+
+	if (directory == NULL) {
+		if ((count = search_powermate_devices_sysfs(NULL, NULL, found_devices)) != -1)
+			return count;
+
+		directory = default_directory;
+	}
+
 	if ((dir = opendir(directory)) == NULL) return -1;
 
 	/* To allocate a new buffer for a complete path is better
@@ -76,8 +110,10 @@ int search_powermate_devices(char *directory, char ***found_devices)
 	filesystem and it spects to find the previous current
 	directory can get a surprise... */
 
-	if ((path = (char *)malloc((size = strlen(directory)) + NAME_MAX)) == NULL)
+	if ((path = (char *)malloc((size = strlen(directory)) + NAME_MAX + 2)) == NULL) {
+		closedir(dir);
 		return -1;
+	}
 
 	strcpy(path, directory);
 	offset = path + size;
@@ -88,12 +124,10 @@ int search_powermate_devices(char *directory, char ***found_devices)
 	}
 
 	*found_devices = NULL;
+	count = 0;
 
-	for (	readdir_r(dir, &u.entry, &result);
-		result == &u.entry;
-		readdir_r(dir, &u.entry, &result)
-	) {
-		strcpy(offset, u.entry.d_name);
+	while ((entry = readdir(dir)) != NULL) {
+		strcpy(offset, entry->d_name);
 
 		if (	stat(path, &entry_stat) == -1
 			|| !S_ISCHR(entry_stat.st_mode)
@@ -101,13 +135,11 @@ int search_powermate_devices(char *directory, char ***found_devices)
 		) continue;
 
 		if (get_powermate_model(fd) != NULL) {
-			size = (count + 1) * sizeof(char *);
-
-			if ((a = (char **)realloc((void *)*found_devices, size)) == NULL)
-				return count;
+			if (powermate_add_found(found_devices, count, path)) {
+				close(fd);
+				break;
+			}
 
-			/* (char *) cast to avoid warning when compiling with -ansi gcc option */
-			(*found_devices = a)[count] = (char *)strdup((const char *)path);
 			count++;
 		}
 
@@ -120,53 +152,322 @@ int search_powermate_devices(char *directory, char ***found_devices)
 }
 
 
+/* Reads a sysfs attribute into buffer (newline stripped) */
+
+static int powermate_read_attribute(const char *path, char *buffer, size_t size)
+{
+	int fd;
+	ssize_t length;
+
+	if ((fd = open(path, O_RDONLY)) == -1) return -1;
+	length = read(fd, buffer, size - 1);
+	close(fd);
+	if (length < 0) return -1;
+	if (length && buffer[length - 1] == '\n') length--;
+	buffer[length] = 0;
+	return 0;
+}
+
+
+/* Identifies the evdev nodes through their sysfs attributes: the USB
+vendor and product IDs and, for devices which do not provide them, the
+name. No device node is opened. sysfs defaults to "/sys" and directory
+(where the nodes are expected) to "/dev/input". */
+
+int search_powermate_devices_sysfs(const char *sysfs, const char *directory, char ***found_devices)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char *path, *offset, value[256];
+	size_t size;
+	unsigned int index, vendor, product;
+	int count = 0;
+
+	if (sysfs == NULL) sysfs = "/sys";
+	if (directory == NULL) directory = "/dev/input";
+
+	size = strlen(sysfs) + strlen(directory) + NAME_MAX + 64;
+	if ((path = (char *)malloc(size)) == NULL) return -1;
+	offset = path + sprintf(path, "%s/class/input/", sysfs);
+
+	if ((dir = opendir(path)) == NULL) {
+		free(path);
+		return -1;
+	}
+
+	*found_devices = NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "event", 5)) continue;
+
+		/* Vendor first, it tells apart almost every other device
+		with a single small read */
+
+		sprintf(offset, "%s/device/id/vendor", entry->d_name);
+
+		if (!powermate_read_attribute(path, value, sizeof(value))) {
+			vendor = (unsigned int)strtoul(value, NULL, 16);
+
+			for (index = 0; index != POWERMATE_MODELS; index++)
+				if (powermate_models[index].vendor == vendor) break;
+
+			if (index == POWERMATE_MODELS) continue;
+			sprintf(offset, "%s/device/id/product", entry->d_name);
+			if (powermate_read_attribute(path, value, sizeof(value))) continue;
+			product = (unsigned int)strtoul(value, NULL, 16);
+
+			for (index = 0; index != POWERMATE_MODELS; index++) if (
+				powermate_models[index].vendor == vendor &&
+				powermate_models[index].product == product
+			) break;
+
+		} else {sprintf(offset, "%s/device/name", entry->d_name);
+			if (powermate_read_attribute(path, value, sizeof(value))) continue;
+
+			for (index = 0; index != POWERMATE_MODELS; index++)
+				if (!strcmp(powermate_models[index].name, value)) break;
+		}
+
+		if (index == POWERMATE_MODELS) continue;
+
+		/* The node path reuses the tail of the same buffer */
+
+		sprintf(offset, "%s%s%s", directory,
+			directory[strlen(directory) - 1] == '/' ? "" : "/", entry->d_name);
+
+		if (powermate_add_found(found_devices, count, offset)) break;
+		count++;
+	}
+
+	free(path);
+	closedir(dir);
+	return count;
+}
+
+
 const char *get_powermate_model(int fd)
 {
 	unsigned int index;
 	char id_buff[256];
-	const char *id_strings[] = {
-		"Griffin SoundKnob",
-		"Griffin PowerMate"
-	};
-
-	ioctl(fd, EVIOCGNAME(255), &id_buff);
-	for (index = 0; index != 2; index ++)
-		if (!strcmp(id_strings[index], id_buff)) return id_strings[index];
+
+	if (ioctl(fd, EVIOCGNAME(255), &id_buff) < 0) return NULL;
+	id_buff[255] = 0;
+	for (index = 0; index != POWERMATE_MODELS; index ++)
+		if (!strcmp(powermate_models[index].name, id_buff)) return powermate_models[index].name;
 	return NULL;
 }
 
 
-PowerMate *powermate_new(const char *device, PowerMateHandlers *handlers)
+static PowerMate *powermate_alloc(void)
 {
-	PowerMate *pm = (PowerMate *)malloc(sizeof(PowerMate));
+	PowerMate *pm = (PowerMate *)calloc(1, sizeof(PowerMate));
 
 	if (pm == NULL) {
 		errno = ENOMEM;
 		return NULL;
 	}
 
-	if (stat(device, &pm->stat)) goto failed;
-	if (!S_ISCHR(pm->stat.st_mode)) goto failed_no_device;
-	if ((pm->input = open(device, O_RDONLY)) == -1) goto failed;
-	if ((pm->model_id = get_powermate_model(pm->input)) == NULL) goto failed_no_device;
-	pm->output = open(device, O_WRONLY);
-	if (handlers != NULL) powermate_set_handlers(pm, handlers);
-	/* (char *) cast to avoid warning when compiling with -ansi gcc option */
-	if ((pm->device = (char *)strdup(device)) == NULL) goto failed;
+	if ((pm->buffer = (char *)malloc(POWERMATE_BUFFER_EVENTS * sizeof(struct pm_event))) == NULL) {
+		free(pm);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pm->input = pm->output = -1;
+	pm->transport = &powermate_evdev_transport;
+	pm->gesture.double_click = POWERMATE_DOUBLE_CLICK_TIME;
+	pm->gesture.long_press = POWERMATE_LONG_PRESS_TIME;
+	pm->filter.types = ~0U;
 	return pm;
+}
+
+
+/* Default transport, an evdev node (or any descriptor) read and written
+with plain system calls. Its open() argument is the node path. */
+
+static int powermate_evdev_open(PowerMate *pm, void *argument)
+{
+	const char *device = (const char *)argument;
+	int nonblock = pm->flags & POWERMATE_OPEN_NONBLOCK ? O_NONBLOCK : 0;
+
+	if (stat(device, &pm->stat)) return -1;
+
+	if (!S_ISCHR(pm->stat.st_mode)) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	/* A single descriptor halves the descriptors and opens per
+	device. Without write permission the LED is just unavailable. */
+
+	if (pm->flags & POWERMATE_OPEN_SINGLE_FD) {
+		if ((pm->input = pm->output = open(device, O_RDWR | O_CLOEXEC | nonblock)) == -1) {
+			if (errno != EACCES && errno != EPERM && errno != EROFS) return -1;
+			if ((pm->input = open(device, O_RDONLY | O_CLOEXEC | nonblock)) == -1) return -1;
+			pm->output = -1;
+		}
+
+	} else {
+		if ((pm->input = open(device, O_RDONLY | nonblock)) == -1) return -1;
+		pm->output = open(device, O_WRONLY);
+	}
+
+	pm->nonblock = nonblock != 0;
+
+	/* (char *) cast to avoid warning when compiling with -ansi gcc option */
+	if ((pm->device = (char *)strdup(device)) == NULL) {
+		close(pm->input);
+		if (pm->output > -1) close(pm->output);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static ssize_t powermate_evdev_read(PowerMate *pm, void *buffer, size_t size)
+{
+	return read(pm->input, buffer, size);
+}
+
+
+static ssize_t powermate_evdev_write(PowerMate *pm, const void *buffer, size_t size)
+{
+	return write(pm->output, buffer, size);
+}
+
+
+static const char *powermate_evdev_identify(PowerMate *pm)
+{
+	return get_powermate_model(pm->input);
+}
+
+
+static int powermate_evdev_close(PowerMate *pm)
+{
+	if (pm->input > -1) close(pm->input);
+	if (pm->output > -1 && pm->output != pm->input) close(pm->output);
+	return 0;
+}
+
+
+const PowerMateTransport powermate_evdev_transport = {
+	powermate_evdev_open,
+	powermate_evdev_read,
+	powermate_evdev_write,
+	powermate_evdev_identify,
+	powermate_evdev_close
+};
+
+
+/* Common constructor. The transport open() sees the POWERMATE_OPEN_*
+flags in pm->flags, sets up descriptors (left at -1 if it has none) and
+transport data from argument, leaving nothing behind on failure. Devices
+it can not identify are refused. The grab is taken once the device is
+identified and released when it is destroyed. */
+
+static PowerMate *powermate_create(
+	const PowerMateTransport *transport,
+	void *argument,
+	int flags,
+	PowerMateHandlers *handlers
+){
+	PowerMate *pm = powermate_alloc();
+
+	if (pm == NULL) return NULL;
+	pm->transport = transport;
+	pm->flags = flags;
+
+	if (transport->open(pm, argument)) {
+		int error = errno;
+
+		free(pm->buffer);
+		free(pm);
+		errno = error;
+		return NULL;
+	}
 
-	failed_no_device:
+	if ((pm->model_id = transport->identify(pm)) == NULL) {
+		powermate_destroy(pm);
 		errno = ENODEV;
-	failed:
+		return NULL;
+	}
+
+	if ((flags & POWERMATE_OPEN_GRAB) && ioctl(pm->input, EVIOCGRAB, 1) < 0) {
+		int error = errno;
+
+		powermate_destroy(pm);
+		errno = error;
+		return NULL;
+	}
+
+	if (handlers != NULL) powermate_set_handlers(pm, handlers);
+	return pm;
+}
+
+
+/* Creates a device over any transport */
+
+PowerMate *powermate_new_transport(
+	const PowerMateTransport *transport,
+	void *argument,
+	PowerMateHandlers *handlers
+){
+	return powermate_create(transport, argument, 0, handlers);
+}
+
+
+PowerMate *powermate_new(const char *device, PowerMateHandlers *handlers)
+{
+	return powermate_create(&powermate_evdev_transport, (void *)device, 0, handlers);
+}
+
+
+/* powermate_new() with POWERMATE_OPEN_* flags. The grab keeps the X
+server, libinput and anything else reading the node from being woken by
+every turn. */
+
+PowerMate *powermate_new_options(const char *device, int flags, PowerMateHandlers *handlers)
+{
+	return powermate_create(&powermate_evdev_transport, (void *)device, flags, handlers);
+}
+
+
+/* Wraps already opened descriptors (pipes, sockets, ...). No model
+check is done, so this is mostly useful for testing and benchmarking */
+
+PowerMate *powermate_new_from_fd(int input, int output, PowerMateHandlers *handlers)
+{
+	PowerMate *pm = powermate_alloc();
+
+	if (pm == NULL) return NULL;
+	if (fstat(input, &pm->stat)) {
+		free(pm->buffer);
 		free(pm);
 		return NULL;
+	}
+
+	pm->input = input;
+	pm->output = output;
+	pm->model_id = pm->transport->identify(pm);
+	if (handlers != NULL) powermate_set_handlers(pm, handlers);
+	return pm;
 }
 
 
+/* An animation of the device is stopped and a deferred LED word is
+written first, the device is left in the last state requested */
+
 int powermate_destroy(PowerMate *pm)
 {
-	if (pm->input > -1) close(pm->input);
-	if (pm->output > -1) close(pm->output);
+	if (pm->animator != NULL) powermate_animator_stop(pm->animator, pm);
+	if (pm->led_writer.deferred) powermate_flush_led(pm);
+	if (pm->published != NULL) powermate_unpublish(pm);
+	pm->transport->close(pm);
+	free(pm->stats);
+	free(pm->device);
+	free(pm->buffer);
 	free(pm);
 	return 0;
 }
@@ -206,160 +507,1131 @@ int powermate_destroy(PowerMate *pm)
 	Only values of 'arg' quite close to 255 are particularly useful/spectacular.			*/
 
 
-int powermate_get_events(PowerMate *pm)
-{
-	struct pm_event event;
-	struct timeval tv;
-	unsigned long long int
-		last_up = 0, last_down = 0,
-		last_left = 0, last_right = 0,
-		last_led = 0, now;
-	int retval;
+/* Pulls as many events as the kernel has queued (up to the buffer size)
+with a single read(). Incomplete records are kept at the buffer start so
+that stream transports which split them work too. */
 
-	while (read(pm->input, &event, sizeof(struct pm_event)) != -1) {
-		if (gettimeofday(&tv, NULL) == -1) return -1;
-		now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+static int powermate_fill_buffer(PowerMate *pm)
+{
+	size_t pending = pm->buffer_end - pm->buffer_begin;
+	ssize_t size;
 
-		switch (event.type) {
-			case EV_KEY:
-				if (event.data == 0) {
-					if (pm->handlers.up != NULL) {
-						if ((retval = pm->handlers.up(
-							pm, pm->handlers.data,
-							last_up ? now - last_up : 0
-						))) return retval;
-						last_up = now;
-						}
-				} else if (event.data == 1) {
-					if (pm->handlers.down != NULL) {
-						if ((retval = pm->handlers.down(
-							pm, pm->handlers.data,
-							last_down ? now - last_down : 0
-						))) return retval;
-						last_down = now;
-					}
-				}
-				break;
+	if (pending && pm->buffer_begin)
+		memmove(pm->buffer, pm->buffer + pm->buffer_begin, pending);
 
-			case EV_REL:
-				if ((int)event.data > 0) {
-					if (pm->handlers.right != NULL) {
-						if ((retval = pm->handlers.right(
-							pm, pm->handlers.data,
-							last_right ? now - last_right : 0,
-							event.data
-						))) return retval;
-						last_right = now;
-					}
-				} else if ((int)event.data < 0) {
-					if (pm->handlers.left != NULL) {
-						if ((retval = pm->handlers.left(
-							pm, pm->handlers.data,
-							last_left ? now - last_left : 0,
-							(unsigned int)-(int)event.data
-						))) return retval;
-						last_left = now;
-					}
-				}
-				break;
+	pm->buffer_begin = 0;
+	pm->buffer_end = pending;
+	pm->reads++;
 
-			case EV_MSC:
-				pm->led.static_brightness = (unsigned char)(event.data & 0xFF);
-				pm->led.pulse_speed = (unsigned short)(event.data >> 8) & 0x1FF;
-				pm->led.pulse_table = (unsigned char)(event.data >> 17) & 3;
-				pm->led.pulse_asleep = (unsigned char)(event.data >> 19) & 1;
-				pm->led.pulse_awake = (unsigned char)(event.data >> 20) & 1;
-
-				if (pm->handlers.led != NULL)
-					if ((retval = pm->handlers.led(
-						pm, pm->handlers.data,
-						last_led ? now - last_led : 0,
-						&pm->led
-					))) return retval;
-					last_led = now;
-				break;
-		}
+	if ((size = pm->transport->read(
+		pm, pm->buffer + pending,
+		POWERMATE_BUFFER_EVENTS * sizeof(struct pm_event) - pending
+	)) <= 0) {
+		if (!size) errno = ENODEV;
+		return -1;
 	}
 
-	return -1;
+	pm->buffer_end += size;
+	return 0;
 }
 
 
-int powermate_set_handlers(PowerMate *pm, PowerMateHandlers *handlers)
+/* Keeps a sliding window of the last rotation events to estimate the
+knob velocity (units/s, positive to the right) and acceleration (units/s²).
+Both are updated in constant time, the window restarts after the knob
+stays still for POWERMATE_MOTION_TIMEOUT microseconds. */
+
+static void powermate_update_motion(PowerMate *pm, long long int time, int units)
 {
-	if (handlers == NULL) {
-		errno = EFAULT;
-		return -1;
+	PowerMateMotion *motion = &pm->motion;
+	unsigned int index = motion->index, first;
+	long long int span;
+	double velocity = 0, acceleration = 0;
+
+	if (motion->count && time - motion->time[
+		(index + POWERMATE_MOTION_WINDOW - 1) % POWERMATE_MOTION_WINDOW
+	] > POWERMATE_MOTION_TIMEOUT) {
+		motion->count = 0;
+		motion->sum = 0;
 	}
 
-	if (handlers != &pm->handlers) memmove(&pm->handlers, handlers, sizeof(PowerMateHandlers));
-	return 0;
-}
+	if (motion->count == POWERMATE_MOTION_WINDOW) motion->sum -= motion->units[index];
+	else motion->count++;
 
+	motion->time[index] = time;
+	motion->units[index] = units;
+	motion->sum += units;
+	motion->index = (index + 1) % POWERMATE_MOTION_WINDOW;
+	first = (motion->index + POWERMATE_MOTION_WINDOW - motion->count) % POWERMATE_MOTION_WINDOW;
 
-int powermate_set_led(PowerMate *pm, PowerMateLED *led)
-{
-	if (led == NULL) led = &pm->led;
+	/* The units of the oldest event were turned before the window
+	starts, and its velocity is only meaningful from the second one */
 
-	if (pm->output < 0) {
-		errno = EBADF;
-		return -1;
-	}
+	if ((span = time - motion->time[first]) > 0) {
+		velocity = (double)(motion->sum - motion->units[first]) * 1000000 / span;
+		first = (first + 1) % POWERMATE_MOTION_WINDOW;
 
-	if (	led->pulse_table > 2 || led->pulse_asleep > 1 ||
-		led->pulse_awake > 1 || led->pulse_speed > 510
-	) {
-		errno = EINVAL;
-		return -1;
-	} else {struct pm_event e = {
-			0, 0, EV_MSC, MSC_PULSELED,
-			((unsigned int)led->static_brightness & 0xFF)
-			| ((unsigned int)(led->pulse_speed & 0x1FF) << 8)
-			| ((unsigned int)(led->pulse_table) << 17)
-			| ((unsigned int)(led->pulse_asleep) << 19)
-			| ((unsigned int)(led->pulse_awake) << 20)
-		};
-
-		if (write(pm->output, &e, sizeof(struct pm_event)) < 0) return -1;
-		if (led != &pm->led)
-			memmove(&pm->led, led, sizeof(PowerMateLED));
-		return 0;
+		if (motion->count > 2 && (span = time - motion->time[first]) > 0)
+			acceleration = (velocity - motion->velocities[first]) * 1000000 / span;
 	}
+
+	motion->velocities[index] = motion->velocity = velocity;
+	motion->acceleration = acceleration;
 }
 
 
-int powermate_set_static_brightness(PowerMate *pm, unsigned char brightness)
+/* Handler calls, timed when statistics are enabled */
+
+static long long int powermate_clock_ns(void)
 {
-	pm->led.static_brightness = brightness;
-	return powermate_set_led(pm, NULL);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long int)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 
-int powermate_set_pulse_speed(PowerMate *pm, unsigned short speed)
-{
-	pm->led.pulse_speed = speed;
-	return powermate_set_led(pm, NULL);
+static int powermate_call_rotate(
+	PowerMate *pm,
+	PowerMateHandler handler,
+	PowerMateRotateFunc func,
+	unsigned long long int tesle,
+	unsigned int units
+){
+	long long int start;
+	int retval;
+
+	if (pm->stats == NULL) return func(pm, pm->handlers.data, tesle, units);
+	start = powermate_clock_ns();
+	retval = func(pm, pm->handlers.data, tesle, units);
+	powermate_histogram_add(&pm->stats->handlers[handler], powermate_clock_ns() - start);
+	return retval;
 }
 
 
-int powermate_set_pulse_table(PowerMate *pm, unsigned char table)
-{
-	pm->led.pulse_table = table;
-	return powermate_set_led(pm, NULL);
+static int powermate_call_button(
+	PowerMate *pm,
+	PowerMateHandler handler,
+	PowerMateButtonFunc func,
+	unsigned long long int tesle
+){
+	long long int start;
+	int retval;
+
+	if (pm->stats == NULL) return func(pm, pm->handlers.data, tesle);
+	start = powermate_clock_ns();
+	retval = func(pm, pm->handlers.data, tesle);
+	powermate_histogram_add(&pm->stats->handlers[handler], powermate_clock_ns() - start);
+	return retval;
 }
 
 
-int powermate_set_pulse_asleep(PowerMate *pm, unsigned char state)
+static int powermate_call_led(PowerMate *pm, unsigned long long int tesle)
 {
-	pm->led.pulse_asleep = state;
-	return powermate_set_led(pm, NULL);
+	long long int start;
+	int retval;
+
+	if (pm->stats == NULL) return pm->handlers.led(pm, pm->handlers.data, tesle, &pm->led);
+	start = powermate_clock_ns();
+	retval = pm->handlers.led(pm, pm->handlers.data, tesle, &pm->led);
+	powermate_histogram_add(&pm->stats->handlers[POWERMATE_HANDLER_LED], powermate_clock_ns() - start);
+	return retval;
 }
 
 
-int powermate_set_pulse_awake(PowerMate *pm, unsigned char state)
+/* Applies the acceleration table to a left (direction 0) or right (1)
+rotation, interval being the milliseconds since the previous one in
+the same direction. Returns the units for the handler, 0 while the
+fractions have not made a whole unit yet. */
+
+static unsigned int powermate_accelerate(
+	PowerMate *pm,
+	int direction,
+	unsigned long long int interval,
+	unsigned int units
+){
+	PowerMateAcceleration *acceleration = &pm->acceleration;
+	unsigned long long int scaled;
+
+	if (!acceleration->enabled) return units;
+	if (interval >= POWERMATE_ACCELERATION_STEPS) interval = POWERMATE_ACCELERATION_STEPS - 1;
+
+	scaled = (unsigned long long int)units * acceleration->gain[interval] + acceleration->remainder[direction];
+	acceleration->remainder[direction] = (unsigned int)(scaled & 0xFF);
+	acceleration->remainder[!direction] = 0;
+	return (unsigned int)(scaled >> 8);
+}
+
+
+/* Delivers the rotation merged by the coalescing mode as a single
+left or right callback. Frames whose units cancel out produce none. */
+
+static int powermate_flush_rotation(PowerMate *pm)
 {
-	pm->led.pulse_awake = state;
-	return powermate_set_led(pm, NULL);
+	PowerMateCoalescing *coalescing = &pm->coalescing;
+	unsigned long long int now = (unsigned long long int)coalescing->last / 1000, tesle, interval;
+	int units = coalescing->units;
+
+	coalescing->merged += coalescing->count - (units != 0);
+	coalescing->count = 0;
+	coalescing->units = 0;
+
+	if (units > 0) {
+		tesle = pm->last_right ? now - pm->last_right : 0;
+		interval = pm->last_right ? tesle : POWERMATE_ACCELERATION_STEPS;
+		pm->last_right = now;
+
+		if (pm->pressed && pm->gesture_handlers.press_right != NULL) {
+			coalescing->delivered++;
+
+			return powermate_call_rotate(
+				pm, POWERMATE_HANDLER_PRESS_RIGHT, pm->gesture_handlers.press_right, tesle,
+				(unsigned int)units);
+		}
+
+		if (	pm->handlers.right != NULL &&
+			(units = (int)powermate_accelerate(pm, 1, interval, (unsigned int)units))
+		) {
+			coalescing->delivered++;
+
+			return powermate_call_rotate(
+				pm, POWERMATE_HANDLER_RIGHT, pm->handlers.right, tesle,
+				(unsigned int)units);
+		}
+
+	} else if (units < 0) {
+		tesle = pm->last_left ? now - pm->last_left : 0;
+		interval = pm->last_left ? tesle : POWERMATE_ACCELERATION_STEPS;
+		pm->last_left = now;
+
+		if (pm->pressed && pm->gesture_handlers.press_left != NULL) {
+			coalescing->delivered++;
+
+			return powermate_call_rotate(
+				pm, POWERMATE_HANDLER_PRESS_LEFT, pm->gesture_handlers.press_left, tesle,
+				(unsigned int)-units);
+		}
+
+		if (	pm->handlers.left != NULL &&
+			(units = (int)powermate_accelerate(pm, 0, interval, (unsigned int)-units))
+		) {
+			coalescing->delivered++;
+
+			return powermate_call_rotate(
+				pm, POWERMATE_HANDLER_LEFT, pm->handlers.left, tesle,
+				(unsigned int)units);
+		}
+	}
+
+	return 0;
+}
+
+
+static long long int powermate_clock(int clock_id)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock_id, &ts)) return 0;
+	return (long long int)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* Milliseconds the merged rotation can still wait for more events,
+0 when it must be delivered now and -1 when only SYN_REPORT ends it */
+
+static int powermate_rotation_timeout(PowerMate *pm)
+{
+	PowerMateCoalescing *coalescing = &pm->coalescing;
+	long long int remaining;
+
+	if (coalescing->mode == POWERMATE_COALESCE_NONE) return 0;
+	if (coalescing->mode != POWERMATE_COALESCE_TIME) return -1;
+
+	remaining = coalescing->first + coalescing->window - powermate_clock(pm->clock);
+	return remaining > 0 ? (int)((remaining + 999) / 1000) : 0;
+}
+
+
+/* Milliseconds until the rotation merged in a time window is due, 0
+when it is and -1 if none is waiting. It is delivered by the next
+powermate_get_events(). */
+
+int powermate_coalescing_timeout(PowerMate *pm)
+{
+	if (!pm->coalescing.count || pm->coalescing.mode != POWERMATE_COALESCE_TIME) return -1;
+	return powermate_rotation_timeout(pm);
+}
+
+
+/* Puts the device in the deferred list of its loop, which syncs its
+LED writes and expires its merged rotation and gesture timeouts */
+
+static void powermate_defer(PowerMate *pm)
+{
+	if (pm->loop != NULL && !pm->led_writer.queued) {
+		pm->led_writer.queued = 1;
+		pm->deferred = pm->loop->deferred;
+		pm->loop->deferred = pm;
+	}
+}
+
+
+/*	Gestures
+
+	Recognized from the button and rotation events with their kernel
+	timestamps, so no time is kept but the last press and release:
+
+	click		press and release shorter than the long press time
+			(of any length with no long_press handler) without
+			rotating, delivered once the double click window
+			ends (right away with no double_click handler)
+	double_click	second press within the window after a click
+	long_press	button held for the long press time without rotating,
+			delivered when it expires, not at release
+	press_left,	rotation while pressed, instead of left and right;
+	press_right	any rotation cancels the click and long press
+
+	The handlers are installed with powermate_set_gesture_handlers().
+	Gesture callbacks of a button event come after its up or down
+	one.								*/
+
+
+static int powermate_gesture_click(PowerMate *pm)
+{
+	PowerMateGesture *gesture = &pm->gesture;
+
+	gesture->click_pending = 0;
+	gesture->deadline = 0;
+
+	return pm->gesture_handlers.click != NULL ? powermate_call_button(
+		pm, POWERMATE_HANDLER_CLICK, pm->gesture_handlers.click,
+		(unsigned long long int)(gesture->released - gesture->pressed) / 1000
+	) : 0;
+}
+
+
+static int powermate_gesture_long_press(PowerMate *pm, long long int time)
+{
+	PowerMateGesture *gesture = &pm->gesture;
+
+	gesture->consumed = 1;
+	gesture->deadline = 0;
+
+	return pm->gesture_handlers.long_press != NULL ? powermate_call_button(
+		pm, POWERMATE_HANDLER_LONG_PRESS, pm->gesture_handlers.long_press,
+		(unsigned long long int)(time - gesture->pressed) / 1000
+	) : 0;
+}
+
+
+/* Delivers the timeout reached at time, whichever it is */
+
+static int powermate_gesture_expire(PowerMate *pm, long long int time)
+{
+	return pm->gesture.click_pending
+		? powermate_gesture_click(pm)
+		: powermate_gesture_long_press(pm, time);
+}
+
+
+/* Updates the recognizer with a press or release, after its up or down
+callback. A timeout due before the event must have been delivered. */
+
+static int powermate_gesture_button(PowerMate *pm, long long int time, int pressed)
+{
+	PowerMateGesture *gesture = &pm->gesture;
+
+	if (pressed) {
+		if (gesture->click_pending) {
+			gesture->click_pending = 0;
+			gesture->deadline = 0;
+			gesture->consumed = 1;
+			gesture->pressed = time;
+			gesture->turned = 0;
+
+			return pm->gesture_handlers.double_click != NULL ? powermate_call_button(
+				pm, POWERMATE_HANDLER_DOUBLE_CLICK, pm->gesture_handlers.double_click,
+				(unsigned long long int)(time - gesture->released) / 1000
+			) : 0;
+		}
+
+		gesture->pressed = time;
+		gesture->turned = 0;
+		gesture->consumed = 0;
+
+		if (pm->gesture_handlers.long_press != NULL && gesture->long_press) {
+			gesture->deadline = time + (long long int)gesture->long_press * 1000;
+			powermate_defer(pm);
+		}
+
+		return 0;
+	}
+
+	gesture->deadline = 0;
+	if (gesture->consumed || gesture->turned) return 0;
+	gesture->released = time;
+
+	if (pm->gesture_handlers.double_click != NULL && gesture->double_click) {
+		gesture->click_pending = 1;
+		gesture->deadline = time + (long long int)gesture->double_click * 1000;
+		powermate_defer(pm);
+		return 0;
+	}
+
+	return powermate_gesture_click(pm);
+}
+
+
+/* Milliseconds until the pending gesture timeout (a long press or the
+end of the double click window), 0 when it is due and -1 if there is
+none. It is delivered by the next powermate_get_events(). */
+
+int powermate_gesture_timeout(PowerMate *pm)
+{
+	long long int remaining;
+
+	if (!pm->gesture.deadline) return -1;
+	remaining = pm->gesture.deadline - powermate_clock(pm->clock);
+	return remaining > 0 ? (int)((remaining + 999) / 1000) : 0;
+}
+
+
+/* Timings in milliseconds, 0 disables double clicks (clicks are then
+delivered at release) or long presses */
+
+int powermate_set_gestures(PowerMate *pm, unsigned int double_click, unsigned int long_press)
+{
+	pm->gesture.double_click = double_click;
+	pm->gesture.long_press = long_press;
+	return 0;
+}
+
+
+/* Called with nothing left in the buffer, before reading again. Runs
+the deferred work which is due (merged rotation, gesture timeouts,
+rate-limited LED writes) and, for blocking descriptors, waits on the input for the
+nearest deadline so that pending work is never stuck behind read(). */
+
+static int powermate_run_deferred(PowerMate *pm)
+{
+	struct pollfd pfd = {pm->input, POLLIN, 0};
+	int timeout, other_timeout, retval;
+
+	for (;;) {
+		timeout = -1;
+
+		if (pm->coalescing.count && !(timeout = powermate_rotation_timeout(pm))) {
+			if ((retval = powermate_flush_rotation(pm))) return retval;
+			timeout = -1;
+		}
+
+		if ((other_timeout = powermate_gesture_timeout(pm)) == 0) {
+			if ((retval = powermate_gesture_expire(pm, powermate_clock(pm->clock)))) return retval;
+
+		} else if (other_timeout != -1 && (timeout == -1 || other_timeout < timeout))
+			timeout = other_timeout;
+
+		if (	(other_timeout = powermate_sync_led(pm)) != -1 &&
+			(timeout == -1 || other_timeout < timeout)
+		) timeout = other_timeout;
+
+		if (timeout == -1 || pm->nonblock || poll(&pfd, 1, timeout)) return 0;
+	}
+}
+
+
+/* The device echoes every LED word it gets */
+
+static void powermate_decode_led(PowerMate *pm, unsigned int word)
+{
+	pm->led.static_brightness = (unsigned char)(word & 0xFF);
+	pm->led.pulse_speed = (unsigned short)(word >> 8) & 0x1FF;
+	pm->led.pulse_table = (unsigned char)(word >> 17) & 3;
+	pm->led.pulse_asleep = (unsigned char)(word >> 19) & 1;
+	pm->led.pulse_awake = (unsigned char)(word >> 20) & 1;
+	pm->led_writer.word = word & 0x1FFFFF;
+	pm->led_writer.valid = 1;
+}
+
+
+int powermate_get_events(PowerMate *pm)
+{
+	struct pm_event event;
+	unsigned long long int now, tesle, interval;
+	unsigned int units;
+	long long int time;
+	int retval, other, error;
+
+	/* Events left in the buffer when a handler stops the loop
+	are dispatched in the next call, timing state lives in the
+	PowerMate object so it survives between calls as well */
+
+	for (;;) {
+		if (pm->buffer_end - pm->buffer_begin < sizeof(struct pm_event)) {
+			if ((retval = powermate_run_deferred(pm))) return retval;
+			if (powermate_fill_buffer(pm) != -1) continue;
+
+			/* Non-blocking descriptors can not wait for the
+			window to expire here. In a PowerMateLoop the merged
+			rotation waits in the deferred list, which drains
+			the device again when the window ends, so deltas of
+			separate reads are merged too. Anywhere else it is
+			delivered right now. */
+
+			if (	pm->coalescing.count &&
+				((error = errno) == EAGAIN || error == EWOULDBLOCK)
+			) {
+				if (pm->loop != NULL && powermate_coalescing_timeout(pm) > 0) powermate_defer(pm);
+				else if ((retval = powermate_flush_rotation(pm))) return retval;
+				errno = error;
+			}
+
+			return -1;
+		}
+
+		memcpy(&event, pm->buffer + pm->buffer_begin, sizeof(struct pm_event));
+		pm->buffer_begin += sizeof(struct pm_event);
+		pm->events++;
+		if (pm->capture != NULL) powermate_capture_event(pm->capture, &event);
+		if (pm->stats != NULL) powermate_stats_event(pm, &event);
+		if (pm->published != NULL) powermate_publish_event(pm->published, &event);
+
+		/* The kernel stamps every event when it happens, using
+		the clock selected with powermate_set_clock() */
+
+		time = (long long int)event.a * 1000000 + event.b;
+		now = (unsigned long long int)time / 1000;
+
+		switch (event.type) {
+			case EV_KEY:
+				pm->pressed = event.data != 0;
+				retval = 0;
+
+				/* The event is consumed already, so all its
+				callbacks are made even if one stops the loop.
+				A gesture timeout which should have expired
+				before it, but had no chance to, goes first. */
+
+				if (pm->gesture.enabled && pm->gesture.deadline && time >= pm->gesture.deadline)
+					retval = powermate_gesture_expire(pm, time);
+
+				if (event.data == 0) {
+					tesle = pm->last_up ? now - pm->last_up : 0;
+					pm->last_up = now;
+
+					if (pm->handlers.up != NULL && (other = powermate_call_button(
+						pm, POWERMATE_HANDLER_UP, pm->handlers.up, tesle
+					)) && !retval) retval = other;
+
+				} else if (event.data == 1) {
+					tesle = pm->last_down ? now - pm->last_down : 0;
+					pm->last_down = now;
+
+					if (pm->handlers.down != NULL && (other = powermate_call_button(
+						pm, POWERMATE_HANDLER_DOWN, pm->handlers.down, tesle
+					)) && !retval) retval = other;
+				}
+
+				if (pm->gesture.enabled && event.data < 2 && (other = powermate_gesture_button(
+					pm, time, (int)event.data
+				)) && !retval) retval = other;
+
+				if (retval) return retval;
+				break;
+
+			case EV_REL:
+				if ((int)event.data) powermate_update_motion(pm, time, (int)event.data);
+
+				if (pm->pressed && !pm->gesture.turned) {
+					pm->gesture.turned = 1;
+					pm->gesture.deadline = 0;
+				}
+
+				if (pm->coalescing.mode != POWERMATE_COALESCE_NONE) {
+					if (!pm->coalescing.count++) pm->coalescing.first = time;
+					pm->coalescing.last = time;
+					pm->coalescing.units += (int)event.data;
+					break;
+				}
+
+				if ((int)event.data > 0) {
+					tesle = pm->last_right ? now - pm->last_right : 0;
+					interval = pm->last_right ? tesle : POWERMATE_ACCELERATION_STEPS;
+					pm->last_right = now;
+
+					if (pm->pressed && pm->gesture_handlers.press_right != NULL) {
+						if ((retval = powermate_call_rotate(
+							pm, POWERMATE_HANDLER_PRESS_RIGHT, pm->gesture_handlers.press_right,
+							tesle, event.data
+						))) return retval;
+
+					} else if (	pm->handlers.right != NULL &&
+						(units = powermate_accelerate(pm, 1, interval, event.data)) &&
+						(retval = powermate_call_rotate(
+							pm, POWERMATE_HANDLER_RIGHT, pm->handlers.right, tesle, units
+						))
+					) return retval;
+
+				} else if ((int)event.data < 0) {
+					tesle = pm->last_left ? now - pm->last_left : 0;
+					interval = pm->last_left ? tesle : POWERMATE_ACCELERATION_STEPS;
+					pm->last_left = now;
+
+					if (pm->pressed && pm->gesture_handlers.press_left != NULL) {
+						if ((retval = powermate_call_rotate(
+							pm, POWERMATE_HANDLER_PRESS_LEFT, pm->gesture_handlers.press_left,
+							tesle, (unsigned int)-(int)event.data
+						))) return retval;
+
+					} else if (	pm->handlers.left != NULL &&
+						(units = powermate_accelerate(pm, 0, interval, (unsigned int)-(int)event.data)) &&
+						(retval = powermate_call_rotate(
+							pm, POWERMATE_HANDLER_LEFT, pm->handlers.left, tesle, units
+						))
+					) return retval;
+				}
+				break;
+
+			case EV_SYN:
+				if (	event.code == SYN_REPORT && pm->coalescing.count && (
+					pm->coalescing.mode != POWERMATE_COALESCE_TIME ||
+					time - pm->coalescing.first >= (long long int)pm->coalescing.window
+				) && (retval = powermate_flush_rotation(pm))) return retval;
+				break;
+
+			case EV_MSC:
+				powermate_decode_led(pm, event.data);
+				tesle = pm->last_led ? now - pm->last_led : 0;
+				pm->last_led = now;
+
+				if (pm->handlers.led != NULL && (retval = powermate_call_led(pm, tesle))) return retval;
+				break;
+		}
+	}
+}
+
+
+/* Pull interface: decodes up to max events into the caller's array with
+no callbacks (handlers and coalescing do not apply). Waits up to timeout
+milliseconds (-1 forever) only when nothing is buffered, so one call
+returns what the device had ready. Returns the events filled, 0 if none
+came in time. */
+
+int powermate_poll_events(PowerMate *pm, PowerMateEvent *events, size_t max, int timeout)
+{
+	struct pollfd pfd = {pm->input, POLLIN, 0};
+	struct pm_event *event;
+	PowerMateEvent *out;
+	unsigned long long int now, *last;
+	long long int time;
+	size_t count = 0;
+	int retval, waited = 0;
+
+	while (count < max) {
+		if (pm->buffer_end - pm->buffer_begin < sizeof(struct pm_event)) {
+			if (count) break;
+
+			/* Blocking inputs are waited on before reading,
+			non-blocking ones only once found empty */
+
+			if (!pm->nonblock && pm->input > -1 && timeout != -1 && !waited) {
+				if ((retval = poll(&pfd, 1, timeout)) <= 0) return retval && errno != EINTR ? -1 : 0;
+				waited = 1;
+			}
+
+			if (powermate_fill_buffer(pm) != -1) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+			if (!timeout || pm->input < 0 || waited) return 0;
+			if ((retval = poll(&pfd, 1, timeout)) <= 0) return retval && errno != EINTR ? -1 : 0;
+			waited = 1;
+			continue;
+		}
+
+		/* Records are decoded in place */
+
+		event = (struct pm_event *)(pm->buffer + pm->buffer_begin);
+		pm->buffer_begin += sizeof(struct pm_event);
+		pm->events++;
+		if (pm->capture != NULL) powermate_capture_event(pm->capture, event);
+		if (pm->stats != NULL) powermate_stats_event(pm, event);
+		if (pm->published != NULL) powermate_publish_event(pm->published, event);
+
+		time = (long long int)event->a * 1000000 + event->b;
+		now = (unsigned long long int)time / 1000;
+		out = events + count;
+
+		switch (event->type) {
+			case EV_KEY:
+				if (event->data > 1) continue;
+				pm->pressed = event->data;
+				out->kind = event->data ? POWERMATE_HANDLER_DOWN : POWERMATE_HANDLER_UP;
+				out->units = 0;
+				last = event->data ? &pm->last_down : &pm->last_up;
+				break;
+
+			case EV_REL:
+				if (!(int)event->data) continue;
+				powermate_update_motion(pm, time, (int)event->data);
+				out->units = (int)event->data;
+
+				if (out->units > 0) {
+					out->kind = POWERMATE_HANDLER_RIGHT;
+					last = &pm->last_right;
+
+				} else {out->kind = POWERMATE_HANDLER_LEFT;
+					last = &pm->last_left;
+				}
+				break;
+
+			case EV_MSC:
+				powermate_decode_led(pm, event->data);
+				out->kind = POWERMATE_HANDLER_LED;
+				out->units = 0;
+				last = &pm->last_led;
+				break;
+
+			default: continue;
+		}
+
+		out->tesle = *last ? now - *last : 0;
+		*last = now;
+		out->pressed = pm->pressed;
+		out->led = pm->led_writer.word;
+		out->time = time;
+		count++;
+	}
+
+	return (int)count;
+}
+
+
+/* Selects the clock used by the kernel to stamp events, CLOCK_MONOTONIC
+keeps the intervals passed to the handlers safe from wall-clock jumps */
+
+int powermate_set_clock(PowerMate *pm, int clock_id)
+{
+	if (clock_id != pm->clock && ioctl(pm->input, EVIOCSCLOCKID, &clock_id) < 0) return -1;
+	pm->clock = clock_id;
+	return 0;
+}
+
+
+/* Rotation events can be merged into a single callback carrying the
+net units, either per input frame (SYN_REPORT) or per time window
+(microseconds). Pending units are delivered after switching it off. */
+
+int powermate_set_coalescing(PowerMate *pm, PowerMateCoalesceMode mode, unsigned int window)
+{
+	if (mode > POWERMATE_COALESCE_TIME) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pm->coalescing.mode = mode;
+	pm->coalescing.window = window;
+	return 0;
+}
+
+
+/* Sets the acceleration table, count gains (8.8 fixed point) for the
+intervals of 0 to count - 1 milliseconds, the last one applying to any
+longer interval. A NULL table switches acceleration off. */
+
+int powermate_set_acceleration(PowerMate *pm, const unsigned short *gains, unsigned int count)
+{
+	PowerMateAcceleration *acceleration = &pm->acceleration;
+	unsigned int index;
+
+	if (gains == NULL) {
+		acceleration->enabled = 0;
+		return 0;
+	}
+
+	if (!count || count > POWERMATE_ACCELERATION_STEPS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (index = 0; index < POWERMATE_ACCELERATION_STEPS; index++)
+		acceleration->gain[index] = gains[index < count ? index : count - 1];
+
+	acceleration->remainder[0] = acceleration->remainder[1] = 0;
+	acceleration->enabled = 1;
+	return 0;
+}
+
+
+/* Builds a ballistic table: gain (8.8 fixed point) for intervals up to
+fast milliseconds, 1x from slow on and a linear ramp in between */
+
+int powermate_set_acceleration_profile(PowerMate *pm, unsigned int fast, unsigned int slow, unsigned int gain)
+{
+	unsigned short gains[POWERMATE_ACCELERATION_STEPS];
+	unsigned int index;
+
+	if (fast >= slow || slow >= POWERMATE_ACCELERATION_STEPS || gain > 0xFFFF) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (index = 0; index < POWERMATE_ACCELERATION_STEPS; index++) gains[index] = (unsigned short)(
+		index <= fast ? (int)gain :
+		index >= slow ? 256 :
+		(int)gain + ((int)(index - fast) * (256 - (int)gain)) / (int)(slow - fast)
+	);
+
+	return powermate_set_acceleration(pm, gains, POWERMATE_ACCELERATION_STEPS);
+}
+
+
+/* Every event read from now on is appended to capture (NULL stops it) */
+
+int powermate_set_capture(PowerMate *pm, PowerMateCapture *capture)
+{
+	pm->capture = capture;
+	return 0;
+}
+
+
+/* Programs the event types the kernel delivers. In-memory devices
+apply the filter themselves when events are injected. */
+
+static int powermate_program_filter(PowerMate *pm, unsigned int types)
+{
+	unsigned long bits = types;
+	struct input_mask mask;
+
+	if (pm->transport != &powermate_memory_transport) {
+		mask.type = EV_SYN;
+		mask.codes_size = sizeof(bits);
+		mask.codes_ptr = (unsigned long)&bits;
+		if (ioctl(pm->input, EVIOCSMASK, &mask) < 0) return -1;
+	}
+
+	pm->filter.types = types;
+	return 0;
+}
+
+
+/* Event types needed by the installed handlers. EV_SYN always is, the
+kernel only wakes up readers at the end of non-empty frames. */
+
+static unsigned int powermate_filter_types(PowerMate *pm)
+{
+	PowerMateHandlers *handlers = &pm->handlers;
+	unsigned int types = 1U << EV_SYN;
+	int pressed_rotation =
+		pm->gesture_handlers.press_left != NULL || pm->gesture_handlers.press_right != NULL;
+
+	if (	handlers->left != NULL || handlers->right != NULL ||
+		pressed_rotation || pm->gesture.enabled
+	) types |= 1U << EV_REL;
+
+	if (	handlers->up != NULL || handlers->down != NULL ||
+		pressed_rotation || pm->gesture.enabled
+	) types |= 1U << EV_KEY;
+
+	if (handlers->led != NULL) types |= 1U << EV_MSC;
+	return types;
+}
+
+
+/* With the filter enabled the kernel drops the events of handlers not
+installed, following every powermate_set_handlers(). Whatever reads
+the device (capture, motion, powermate_poll_events()) sees only the
+remaining ones. */
+
+int powermate_set_event_filter(PowerMate *pm, int enabled)
+{
+	if (powermate_program_filter(pm, enabled ? powermate_filter_types(pm) : ~0U)) return -1;
+	pm->filter.enabled = enabled != 0;
+	return 0;
+}
+
+
+int powermate_set_handlers(PowerMate *pm, PowerMateHandlers *handlers)
+{
+	if (handlers == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (handlers != &pm->handlers) memmove(&pm->handlers, handlers, sizeof(PowerMateHandlers));
+
+	/* A failure leaves the previous filter, which is only less
+	selective than wanted */
+
+	if (pm->filter.enabled) powermate_program_filter(pm, powermate_filter_types(pm));
+	return 0;
+}
+
+
+/* Installs the gesture handlers, called with the data of the
+PowerMateHandlers. NULL removes them all. */
+
+int powermate_set_gesture_handlers(PowerMate *pm, PowerMateGestureHandlers *handlers)
+{
+	if (handlers == NULL) memset(&pm->gesture_handlers, 0, sizeof(PowerMateGestureHandlers));
+	else if (handlers != &pm->gesture_handlers)
+		memmove(&pm->gesture_handlers, handlers, sizeof(PowerMateGestureHandlers));
+
+	/* The recognizer costs nothing unless a gesture is wanted */
+
+	pm->gesture.enabled =
+		pm->gesture_handlers.click != NULL || pm->gesture_handlers.double_click != NULL ||
+		pm->gesture_handlers.long_press != NULL;
+
+	if (!pm->gesture.enabled) {
+		pm->gesture.deadline = 0;
+		pm->gesture.click_pending = 0;
+	}
+
+	if (pm->filter.enabled) powermate_program_filter(pm, powermate_filter_types(pm));
+	return 0;
+}
+
+
+static int powermate_write_led(PowerMate *pm, unsigned int word)
+{
+	PowerMateLEDWriter *writer = &pm->led_writer;
+	struct pm_event e = {0, 0, EV_MSC, MSC_PULSELED, word};
+
+	if (pm->transport->write(pm, &e, sizeof(struct pm_event)) < 0) return -1;
+	writer->deferred = 0;
+	if (pm->published != NULL) powermate_publish_event(pm->published, &e);
+
+	/* The echo of the word would have been a wakeup of its own */
+
+	if (!(pm->filter.types & (1U << EV_MSC)) && pm->transport != &powermate_memory_transport)
+		pm->filter.avoided++;
+
+	writer->word = word;
+	writer->valid = 1;
+	writer->writes++;
+	if (writer->rate) writer->next = powermate_clock(CLOCK_MONOTONIC) + 1000000 / writer->rate;
+	return 0;
+}
+
+
+static int powermate_encode_led(PowerMateLED *led, unsigned int *word)
+{
+	if (	led->pulse_table > 2 || led->pulse_asleep > 1 ||
+		led->pulse_awake > 1 || led->pulse_speed > 510
+	) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*word =	((unsigned int)led->static_brightness & 0xFF)
+		| ((unsigned int)(led->pulse_speed & 0x1FF) << 8)
+		| ((unsigned int)(led->pulse_table) << 17)
+		| ((unsigned int)(led->pulse_asleep) << 19)
+		| ((unsigned int)(led->pulse_awake) << 20);
+	return 0;
+}
+
+
+/* Without a rate every word is written to the device. With a rate (writes
+per second) the LED works in write-behind mode: words equal to the
+device state are dropped and words arriving before their slot are
+kept until it comes, replacing any older one still waiting. */
+
+static int powermate_put_led(PowerMate *pm, unsigned int word)
+{
+	PowerMateLEDWriter *writer = &pm->led_writer;
+
+	if (pm->output < 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (!writer->rate) return powermate_write_led(pm, word);
+
+	if (writer->deferred) {
+		writer->deferred = 0;
+		writer->suppressed++;
+	}
+
+	if (writer->valid && word == writer->word) writer->suppressed++;
+
+	else if (powermate_clock(CLOCK_MONOTONIC) < writer->next) {
+		writer->pending = word;
+		writer->deferred = 1;
+		powermate_defer(pm);
+
+	} else return powermate_write_led(pm, word);
+
+	return 0;
+}
+
+
+int powermate_set_led(PowerMate *pm, PowerMateLED *led)
+{
+	unsigned int word;
+
+	if (led == NULL) led = &pm->led;
+	if (powermate_encode_led(led, &word) || powermate_put_led(pm, word)) return -1;
+	if (led != &pm->led)
+		memmove(&pm->led, led, sizeof(PowerMateLED));
+	return 0;
+}
+
+
+/* Sets one LED configuration on many devices (leds_count == 1) or one
+per device (leds_count == count), encoding it only once in the first
+case. The errno of every device, or 0, is stored in results (if not
+NULL) and the number of failed devices returned. An invalid shared
+configuration fails every device and returns -1.
+
+Devices registered in a PowerMateUring only queue their write, every
+ring is then entered once for all of its devices (a failed submission
+leaves the writes for the next dispatch, as powermate_set_led() does).
+Other devices are written in turn: a ring set up for the call would
+cost more than the dozens of writes it saves, and an evdev write only
+hands the word to the driver. */
+
+int powermate_set_led_many(
+	PowerMate **pms,
+	unsigned int count,
+	PowerMateLED *leds,
+	unsigned int leds_count,
+	int *results
+){
+	PowerMateLED *led = leds;
+	PowerMateUring *uring;
+	unsigned int index, word, failed = 0;
+	int error;
+
+	if (pms == NULL || leds == NULL || (leds_count != 1 && leds_count != count)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (leds_count == 1 && powermate_encode_led(leds, &word)) {
+		if (results != NULL) for (index = 0; index < count; index++) results[index] = errno;
+		return -1;
+	}
+
+	for (index = 0; index < count; index++) {
+		error = 0;
+		if (leds_count != 1) led = leds + index;
+
+		if (pms[index] == NULL) error = EINVAL;
+
+		else if (	(leds_count != 1 && powermate_encode_led(led, &word))
+				|| powermate_put_led(pms[index], word)
+		) error = errno;
+
+		else if (led != &pms[index]->led)
+			memmove(&pms[index]->led, led, sizeof(PowerMateLED));
+
+		if (error) failed++;
+		if (results != NULL) results[index] = error;
+	}
+
+	/* Nothing is left queued once a ring has been entered, the
+	devices after the first one of each ring submit nothing */
+
+	for (index = 0; index < count; index++)
+		if (pms[index] != NULL && (uring = powermate_uring_of(pms[index])) != NULL)
+			powermate_uring_submit(uring);
+
+	return (int)failed;
+}
+
+
+/* Writes the deferred LED word if its slot has come. Returns the
+milliseconds until it can be written or -1 if nothing is waiting. */
+
+int powermate_sync_led(PowerMate *pm)
+{
+	PowerMateLEDWriter *writer = &pm->led_writer;
+	long long int remaining;
+
+	if (!writer->deferred) return -1;
+	if ((remaining = writer->next - powermate_clock(CLOCK_MONOTONIC)) > 0)
+		return (int)((remaining + 999) / 1000);
+
+	/* A failed write keeps the word, it is tried again one slot
+	later instead of right away */
+
+	if (powermate_write_led(pm, writer->pending)) {
+		writer->next = powermate_clock(CLOCK_MONOTONIC) + 1000000 / writer->rate;
+		return (int)((1000 + writer->rate - 1) / writer->rate);
+	}
+
+	writer->flushed++;
+	return -1;
+}
+
+
+/* Writes the deferred LED word right now, ignoring the rate */
+
+int powermate_flush_led(PowerMate *pm)
+{
+	if (!pm->led_writer.deferred) return 0;
+	if (powermate_write_led(pm, pm->led_writer.pending)) return -1;
+	pm->led_writer.flushed++;
+	return 0;
+}
+
+
+/* Switching the rate off writes the deferred word, the rate is kept
+if that fails */
+
+int powermate_set_led_rate(PowerMate *pm, unsigned int rate)
+{
+	if (!rate && powermate_flush_led(pm)) return -1;
+	pm->led_writer.rate = rate;
+	return 0;
+}
+
+
+/* The setters below change pm->led only once the word is written (or
+deferred), a failed write leaves it as the device has it */
+
+int powermate_set_static_brightness(PowerMate *pm, unsigned char brightness)
+{
+	PowerMateLED led = pm->led;
+
+	led.static_brightness = brightness;
+	return powermate_set_led(pm, &led);
+}
+
+
+int powermate_set_pulse_speed(PowerMate *pm, unsigned short speed)
+{
+	PowerMateLED led = pm->led;
+
+	led.pulse_speed = speed;
+	return powermate_set_led(pm, &led);
+}
+
+
+int powermate_set_pulse_table(PowerMate *pm, unsigned char table)
+{
+	PowerMateLED led = pm->led;
+
+	led.pulse_table = table;
+	return powermate_set_led(pm, &led);
+}
+
+
+int powermate_set_pulse_asleep(PowerMate *pm, unsigned char state)
+{
+	PowerMateLED led = pm->led;
+
+	led.pulse_asleep = state;
+	return powermate_set_led(pm, &led);
+}
+
+
+int powermate_set_pulse_awake(PowerMate *pm, unsigned char state)
+{
+	PowerMateLED led = pm->led;
+
+	led.pulse_awake = state;
+	return powermate_set_led(pm, &led);
 }
 
 
@@ -371,12 +1643,14 @@ int powermate_set_all(
 	unsigned char pulse_asleep,
 	unsigned char pulse_awake
 ){
-	pm->led.static_brightness = static_brightness;
-	pm->led.pulse_speed = pulse_speed;
-	pm->led.pulse_table = pulse_table;
-	pm->led.pulse_asleep = pulse_asleep;
-	pm->led.pulse_awake = pulse_awake;
-	return powermate_set_led(pm, NULL);
+	PowerMateLED led;
+
+	led.static_brightness = static_brightness;
+	led.pulse_speed = pulse_speed;
+	led.pulse_table = pulse_table;
+	led.pulse_asleep = pulse_asleep;
+	led.pulse_awake = pulse_awake;
+	return powermate_set_led(pm, &led);
 }
 
 
@@ -26,9 +26,60 @@
 #ifndef __POWERMATE_H__
 #define __POWERMATE_H__
 
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of events pulled from the kernel with a single read() */
+#define POWERMATE_BUFFER_EVENTS 64
+
+/* Bytes of inotify events read at once by a PowerMateWatch */
+#define POWERMATE_WATCH_BUFFER_SIZE 4096
+
+/* Bytes of encoded records kept by a PowerMateCapture before writing */
+#define POWERMATE_CAPTURE_BUFFER_SIZE 4096
+
+/* Capacity of the ring of an in-memory device (a power of 2) */
+#define POWERMATE_MEMORY_EVENTS 4096
+
+/* Capacity of the ring filled by a reader thread (a power of 2) */
+#define POWERMATE_READER_EVENTS 4096
+
+/* LED writes of a device which can be in flight in a PowerMateUring (at most 16) */
+#define POWERMATE_URING_WRITES 8
+
+/* Steps of the brightness curves of a PowerMateAnimator */
+#define POWERMATE_CURVE_STEPS 256
+
+/* Rotation events used to estimate velocity and acceleration */
+#define POWERMATE_MOTION_WINDOW 8
+
+/* Stillness (in microseconds) after which the motion window restarts */
+#define POWERMATE_MOTION_TIMEOUT 200000
+
+/* Entries of the acceleration table, one per millisecond of interval */
+#define POWERMATE_ACCELERATION_STEPS 64
+
+/* Default gesture timings (milliseconds) */
+#define POWERMATE_DOUBLE_CLICK_TIME 300
+#define POWERMATE_LONG_PRESS_TIME 600
+
+/* Histogram buckets per power of 2 (as bits) and powers of 2 covered,
+values are nanoseconds with about 12% precision up to 2^40 (18 minutes) */
+#define POWERMATE_HISTOGRAM_SUB_BITS 3
+#define POWERMATE_HISTOGRAM_MAGNITUDES 38
+#define POWERMATE_HISTOGRAM_BUCKETS \
+	((POWERMATE_HISTOGRAM_MAGNITUDES + 1) << POWERMATE_HISTOGRAM_SUB_BITS)
+
+/* Distinct (type, code) pairs counted by the statistics */
+#define POWERMATE_STATS_CODES 16
+
 typedef enum {
 	POWERMATE_PULSE_MODE_DIVIDE,
 	POWERMATE_PULSE_MODE_NORMAL,
@@ -40,6 +91,46 @@ typedef enum {
 	POWERMATE_PULSE_STATE_ON
 } PowerMatePulseState;
 
+typedef enum {
+	POWERMATE_COALESCE_NONE,
+	POWERMATE_COALESCE_FRAME,
+	POWERMATE_COALESCE_TIME
+} PowerMateCoalesceMode;
+
+typedef enum {
+	POWERMATE_REPLAY_FAST,		 /* as fast as possible */
+	POWERMATE_REPLAY_REALTIME	 /* with the recorded timing */
+} PowerMateReplayPacing;
+
+typedef enum {
+	POWERMATE_HANDLER_LEFT,
+	POWERMATE_HANDLER_RIGHT,
+	POWERMATE_HANDLER_DOWN,
+	POWERMATE_HANDLER_UP,
+	POWERMATE_HANDLER_LED,
+	POWERMATE_HANDLER_CLICK,
+	POWERMATE_HANDLER_DOUBLE_CLICK,
+	POWERMATE_HANDLER_LONG_PRESS,
+	POWERMATE_HANDLER_PRESS_LEFT,
+	POWERMATE_HANDLER_PRESS_RIGHT,
+	POWERMATE_HANDLERS
+} PowerMateHandler;
+
+typedef enum {
+	POWERMATE_CURVE_LINEAR,
+	POWERMATE_CURVE_EASE,		 /* smooth start and end */
+	POWERMATE_CURVE_BREATHE,	 /* up and down again, perceptually smooth */
+	POWERMATE_CURVES
+} PowerMateCurve;
+
+enum {	POWERMATE_WATCH_ANY_NODE = 1	 /* accept every device node or stand-in (testing) */
+};
+
+enum {	POWERMATE_OPEN_SINGLE_FD = 1,	 /* one O_RDWR descriptor, read-only if writing is denied */
+	POWERMATE_OPEN_GRAB = 2,	 /* exclusive access, no other reader gets the events */
+	POWERMATE_OPEN_NONBLOCK = 4	 /* input never blocks, kept after leaving a loop */
+};
+
 enum {	POWERMATE_PULSE_ASLEEP,
 	POWERMATE_PULSE_AWAKE
 };
@@ -47,6 +138,39 @@ enum {	POWERMATE_PULSE_ASLEEP,
 struct PowerMate;
 typedef struct PowerMate PowerMate;
 
+struct PowerMateLoop;
+typedef struct PowerMateLoop PowerMateLoop;
+
+struct PowerMateWatch;
+typedef struct PowerMateWatch PowerMateWatch;
+
+struct PowerMateCapture;
+typedef struct PowerMateCapture PowerMateCapture;
+
+struct PowerMateReplay;
+typedef struct PowerMateReplay PowerMateReplay;
+
+struct PowerMateReader;
+typedef struct PowerMateReader PowerMateReader;
+
+struct PowerMateAnimator;
+typedef struct PowerMateAnimator PowerMateAnimator;
+
+struct PowerMateUring;
+typedef struct PowerMateUring PowerMateUring;
+
+struct PowerMatePublisher;
+typedef struct PowerMatePublisher PowerMatePublisher;
+
+/* Event record as read from and written to the evdev device */
+struct pm_event {
+	long a;
+	long b;
+	short type;
+	short code;
+	unsigned int data;
+};
+
 typedef struct {
 	unsigned char static_brightness; /* LED brightness */
 	unsigned short int pulse_speed;	 /* pulsing speed modifier (0 ... 510);
@@ -69,6 +193,30 @@ typedef int	(*PowerMateLEDFunc)	(PowerMate *pm,
 					unsigned long long int tesle,
 					PowerMateLED *led);
 
+typedef int	(*PowerMateWatchFunc)	(PowerMateWatch *watch,
+					void *data,
+					const char *device);
+
+/* Device backend. read() and write() work like their system call
+counterparts on whole struct pm_event records. */
+typedef struct {
+	int		(*open)		(PowerMate *pm, void *argument);
+	ssize_t		(*read)		(PowerMate *pm, void *buffer, size_t size);
+	ssize_t		(*write)	(PowerMate *pm, const void *buffer, size_t size);
+	const char*	(*identify)	(PowerMate *pm);
+	int		(*close)	(PowerMate *pm);
+} PowerMateTransport;
+
+/* Decoded event, as filled by powermate_poll_events() */
+typedef struct {
+	PowerMateHandler kind;		 /* handler the event would be sent to */
+	int units;			 /* rotation, > 0 to the right */
+	unsigned int pressed;		 /* button state after the event */
+	unsigned int led;		 /* LED word after the event */
+	long long int time;		 /* kernel timestamp (microseconds) */
+	unsigned long long int tesle;	 /* milliseconds since the last event of its kind */
+} PowerMateEvent;
+
 typedef struct {
 	PowerMateRotateFunc left;
 	PowerMateRotateFunc right;
@@ -78,6 +226,106 @@ typedef struct {
 	void *data;
 } PowerMateHandlers;
 
+/* Gesture handlers, set apart with powermate_set_gesture_handlers() and
+called with the data of PowerMateHandlers. Without a long_press handler
+long holds are reported as clicks. */
+typedef struct {
+	PowerMateButtonFunc click;	 /* press and release, tesle = time held */
+	PowerMateButtonFunc double_click; /* tesle = time between the clicks */
+	PowerMateButtonFunc long_press;	 /* fired while held, tesle = time held */
+	PowerMateRotateFunc press_left;	 /* rotation while pressed, instead of left */
+	PowerMateRotateFunc press_right; /* and right */
+} PowerMateGestureHandlers;
+
+typedef struct {
+	long long int time[POWERMATE_MOTION_WINDOW];	 /* event times (microseconds) */
+	int units[POWERMATE_MOTION_WINDOW];		 /* signed units, > 0 to the right */
+	double velocities[POWERMATE_MOTION_WINDOW];	 /* velocity after each event */
+	unsigned int index;				 /* next slot to be written */
+	unsigned int count;				 /* valid slots */
+	long long int sum;				 /* units inside the window */
+	double velocity;				 /* units per second */
+	double acceleration;				 /* units per second² */
+} PowerMateMotion;
+
+/* Rotation acceleration: left and right units are multiplied by the
+gain (8.8 fixed point, 256 is 1x) of the interval since the previous
+rotation in the same direction. Fractions of unit are carried over. */
+typedef struct {
+	unsigned short gain[POWERMATE_ACCELERATION_STEPS]; /* longer intervals use the last one */
+	unsigned int remainder[2];	 /* pending fraction (1/256 units), left and right */
+	unsigned char enabled;
+} PowerMateAcceleration;
+
+/* Incremental gesture recognition, fed with the button and rotation
+events. At most one timeout is pending: the end of the double click
+window or the long press. */
+typedef struct {
+	unsigned int double_click;	 /* window (milliseconds), 0 disables double clicks */
+	unsigned int long_press;	 /* milliseconds, 0 disables long presses */
+	long long int pressed;		 /* time of the last press (microseconds) */
+	long long int released;		 /* time of the release of a click waiting for a second one */
+	long long int deadline;		 /* pending timeout (microseconds), 0 if none */
+	unsigned char turned;		 /* rotated since pressed */
+	unsigned char consumed;		 /* this press already made its gesture */
+	unsigned char click_pending;	 /* click waiting for the window to end */
+	unsigned char enabled;		 /* some gesture handler is installed */
+} PowerMateGesture;
+
+/* Kernel event filter (EVIOCSMASK): event types no handler uses are
+never queued, so frames made only of them wake nobody up */
+typedef struct {
+	unsigned int types;		 /* types delivered, a bit per EV_* */
+	unsigned char enabled;		 /* types follow the installed handlers */
+	unsigned long long int avoided;	 /* wakeups known to be saved (LED echoes, stand-in frames) */
+} PowerMateFilter;
+
+typedef struct {
+	PowerMateCoalesceMode mode;
+	unsigned int window;		 /* time window (microseconds) */
+	int units;			 /* pending net rotation */
+	unsigned int count;		 /* pending rotation events */
+	long long int first;		 /* time of the first pending event (microseconds) */
+	long long int last;		 /* time of the last pending event (microseconds) */
+	unsigned long long int merged;	 /* rotation events folded into another callback */
+	unsigned long long int delivered; /* coalesced callbacks */
+} PowerMateCoalescing;
+
+typedef struct {
+	unsigned int rate;		 /* maximum writes per second, 0 writes every request */
+	unsigned int word;		 /* last word known to be in the device */
+	unsigned int pending;		 /* word waiting for its slot */
+	unsigned char valid;		 /* word holds the device state */
+	unsigned char deferred;		 /* pending holds a word to be written */
+	unsigned char queued;		 /* device is in the deferred list of its loop (LED, rotation or gesture timeouts) */
+	long long int next;		 /* earliest time for the next write (CLOCK_MONOTONIC, microseconds) */
+	unsigned long long int writes;	 /* words written to the device */
+	unsigned long long int suppressed; /* requests dropped, unchanged or replaced while waiting */
+	unsigned long long int flushed;	 /* deferred words written when their slot came */
+} PowerMateLEDWriter;
+
+typedef struct {
+	unsigned long long int count;
+	unsigned long long int sum;	 /* nanoseconds */
+	unsigned long long int min;
+	unsigned long long int max;
+	unsigned int buckets[POWERMATE_HISTOGRAM_BUCKETS];
+} PowerMateHistogram;
+
+typedef struct {
+	unsigned short type;
+	unsigned short code;
+	unsigned long long int count;
+} PowerMateEventCount;
+
+typedef struct {
+	PowerMateHistogram latency;	 /* kernel timestamp to dispatch */
+	PowerMateHistogram handlers[POWERMATE_HANDLERS]; /* time spent in each callback */
+	PowerMateEventCount codes[POWERMATE_STATS_CODES]; /* events by type and code */
+	unsigned long long int other;	 /* events not fitting in codes */
+	unsigned long long int events;
+} PowerMateStats;
+
 struct PowerMate {
 	int input;
 	int output;
@@ -86,20 +334,151 @@ struct PowerMate {
 	const char *model_id;
 	PowerMateLED led;
 	PowerMateHandlers handlers;
+	unsigned long long int last_up;	 /* time of the last event of each kind (milliseconds) */
+	unsigned long long int last_down;
+	unsigned long long int last_left;
+	unsigned long long int last_right;
+	unsigned long long int last_led;
+	PowerMateMotion motion;
+	PowerMateAcceleration acceleration;
+	PowerMateCoalescing coalescing;
+	PowerMateLEDWriter led_writer;
+	PowerMateGesture gesture;
+	PowerMateFilter filter;
+	const PowerMateTransport *transport;
+	void *transport_data;
+	PowerMateCapture *capture;	 /* where the events read are recorded */
+	PowerMateStats *stats;		 /* instrumentation, NULL when disabled */
+	PowerMateReader *reader;	 /* reader thread, if started */
+	PowerMateAnimator *animator;	 /* animating the LED, if any */
+	struct PowerMateSharedDevice *published; /* slot of a publisher segment, NULL if none */
+	PowerMateLoop *loop;		 /* loop the device is registered in */
+	PowerMate *deferred;		 /* next device with deferred work in the loop */
+	char *buffer;			 /* pending events read but not dispatched yet */
+	size_t buffer_begin;
+	size_t buffer_end;
+	unsigned long long int reads;	 /* read() calls done */
+	unsigned long long int events;	 /* events dispatched */
+	int clock;			 /* clock stamping the events (CLOCK_REALTIME by default) */
+	int nonblock;			 /* input is in non-blocking mode */
+	unsigned int pressed;		 /* button state */
+	PowerMateGestureHandlers gesture_handlers;
+	int flags;			 /* POWERMATE_OPEN_* the device was opened with */
 };
 
+struct PowerMateLoop {
+	int fd;				 /* epoll instance */
+	unsigned int count;		 /* registered devices */
+	PowerMateWatch *watch;		 /* hotplug watcher, if any */
+	PowerMateAnimator *animator;	 /* LED animator, if any */
+	void *ready;			 /* descriptors returned by the last epoll_wait() */
+	int ready_count;
+	int ready_index;
+	PowerMate *pending;		 /* device stopped by a handler with events left */
+	PowerMate *deferred;		 /* devices with deferred work (LED writes, timeouts) */
+	PowerMate *failed;		 /* last device dropped because of a read error */
+	unsigned long long int wakeups;	 /* epoll_wait() calls returning events */
+};
+
+struct PowerMateWatch {
+	int fd;				 /* inotify instance */
+	int flags;			 /* POWERMATE_WATCH_* */
+	char *directory;		 /* watched directory, with room for a node name */
+	size_t length;			 /* length of the directory path */
+	char **devices;			 /* names of the devices present */
+	unsigned int count;
+	unsigned int size;
+	PowerMateWatchFunc added;
+	PowerMateWatchFunc removed;
+	void *data;
+	char *buffer;			 /* inotify events not processed yet */
+	size_t begin;
+	size_t end;
+};
+
+
+extern const PowerMateTransport powermate_evdev_transport;
+extern const PowerMateTransport powermate_memory_transport;
 
 #define powermate_get_state(p) p->state
+#define powermate_get_velocity(p) (p)->motion.velocity
+#define powermate_get_acceleration(p) (p)->motion.acceleration
 
+int		search_powermate_devices	(char *directory,
+						char ***found_devices);
+int		search_powermate_devices_sysfs	(const char *sysfs,
+						const char *directory,
+						char ***found_devices);
 const char*	get_powermate_model		(int fd);
 PowerMate*	powermate_new			(const char *device,
 						PowerMateHandlers *handlers);
+PowerMate*	powermate_new_options		(const char *device,
+						int flags,
+						PowerMateHandlers *handlers);
+PowerMate*	powermate_new_transport		(const PowerMateTransport *transport,
+						void *argument,
+						PowerMateHandlers *handlers);
+PowerMate*	powermate_new_from_fd		(int input,
+						int output,
+						PowerMateHandlers *handlers);
+PowerMate*	powermate_new_replay		(PowerMateReplay *replay,
+						PowerMateHandlers *handlers);
+PowerMate*	powermate_new_memory		(PowerMateHandlers *handlers);
+int		powermate_memory_inject		(PowerMate *pm,
+						const struct pm_event *events,
+						unsigned int count);
 int		powermate_destroy		(PowerMate *pm);
 int		powermate_get_events		(PowerMate *pm);
+int		powermate_poll_events		(PowerMate *pm,
+						PowerMateEvent *events,
+						size_t max,
+						int timeout);
+int		powermate_set_clock		(PowerMate *pm,
+						int clock_id);
+int		powermate_set_coalescing	(PowerMate *pm,
+						PowerMateCoalesceMode mode,
+						unsigned int window);
+int		powermate_coalescing_timeout	(PowerMate *pm);
+int		powermate_set_capture		(PowerMate *pm,
+						PowerMateCapture *capture);
+int		powermate_set_event_filter	(PowerMate *pm,
+						int enabled);
 int		powermate_set_handlers		(PowerMate *pm,
 						PowerMateHandlers *handlers);
+int		powermate_start_reader		(PowerMate *pm);
+int		powermate_stop_reader		(PowerMate *pm);
+int		powermate_set_stats		(PowerMate *pm,
+						int enabled);
+int		powermate_get_stats		(PowerMate *pm,
+						PowerMateStats *stats);
+void		powermate_histogram_add		(PowerMateHistogram *histogram,
+						unsigned long long int value);
+unsigned long long int powermate_histogram_percentile(PowerMateHistogram *histogram,
+						double percentile);
 int		powermate_set_led		(PowerMate *pm,
 						PowerMateLED *led);
+int		powermate_set_led_many		(PowerMate **pms,
+						unsigned int count,
+						PowerMateLED *leds,
+						unsigned int leds_count,
+						int *results);
+int		powermate_set_led_rate		(PowerMate *pm,
+						unsigned int rate);
+int		powermate_sync_led		(PowerMate *pm);
+int		powermate_set_acceleration	(PowerMate *pm,
+						const unsigned short *gains,
+						unsigned int count);
+int		powermate_set_acceleration_profile(PowerMate *pm,
+						unsigned int fast,
+						unsigned int slow,
+						unsigned int gain);
+int		powermate_set_gesture_handlers	(PowerMate *pm,
+						PowerMateGestureHandlers *handlers);
+int		powermate_set_gestures		(PowerMate *pm,
+						unsigned int double_click,
+						unsigned int long_press);
+int		powermate_gesture_timeout	(PowerMate *pm);
+int		powermate_flush_led		(PowerMate *pm);
 int		powermate_set_static_brightness	(PowerMate *pm,
 						unsigned char brightness);
 int		powermate_set_pulse_speed	(PowerMate *pm,
@@ -117,4 +496,282 @@ int		powermate_set_all		(PowerMate *pm,
 						unsigned char pulse_asleep,
 						unsigned char pulse_awake);
 
+struct PowerMateCapture {
+	int fd;
+	unsigned char *buffer;		 /* encoded records not written yet */
+	size_t size;
+	long long int time;		 /* time of the last record (microseconds) */
+	unsigned long long int records;
+	int error;			 /* errno of the first failed write, if any */
+};
+
+struct PowerMateReplay {
+	const unsigned char *data;	 /* mapped capture file */
+	size_t size;
+	size_t offset;			 /* next record */
+	PowerMateReplayPacing pacing;
+	long long int time;		 /* time of the last decoded record (microseconds) */
+	long long int first;		 /* time of the first record */
+	long long int start;		 /* CLOCK_MONOTONIC when the first record was replayed */
+	struct pm_event next;		 /* decoded record waiting for its time */
+	int ready;			 /* next is valid */
+	unsigned long long int records;	 /* records replayed */
+};
+
+typedef struct {
+	struct pm_event *ring;		 /* injected events not read yet */
+	unsigned int head;
+	unsigned int tail;
+	unsigned int led;		 /* last LED word written */
+	unsigned long long int led_writes;
+	unsigned int frame;		 /* events injected since the last SYN_REPORT */
+} PowerMateMemory;
+
+/* Single-producer/single-consumer ring between the reader thread and
+the thread dispatching the events. Counters are written by the reader
+thread only. */
+struct PowerMateReader {
+	pthread_t thread;
+	int fd;				 /* device descriptor read by the thread */
+	int wakeup;			 /* eventfd written to stop the thread */
+	int quit;			 /* set before writing it */
+	const PowerMateTransport *transport; /* transport replaced while running */
+	void *transport_data;
+	struct pm_event *ring;
+	unsigned int head;		 /* written by the reader thread */
+	char padding[60];		 /* keeps head and tail in different cache lines */
+	unsigned int tail;		 /* written by the consumer */
+	int units;			 /* rotation folded while the ring was full */
+	struct pm_event last;		 /* last event read, stamps the folded one */
+	unsigned int pressed;		 /* button state as read from the device */
+	unsigned int queued_pressed;	 /* button state as last queued */
+	int overflowing;
+	int error;			 /* errno which stopped the thread, 0 while running */
+	unsigned long long int overflows; /* times the ring was found full */
+	unsigned long long int dropped;	 /* events discarded or folded because of it */
+	unsigned long long int kernel_drops; /* SYN_DROPPED received from the kernel */
+};
+
+typedef struct {
+	PowerMate *pm;
+	PowerMateCurve curve;
+	unsigned char from;		 /* brightness at the curve start */
+	unsigned char to;		 /* brightness at the curve end */
+	int repeat;			 /* starts over when done */
+	long long int start;		 /* CLOCK_MONOTONIC (microseconds) */
+	long long int duration;		 /* microseconds, 0 for a single frame */
+} PowerMateAnimation;
+
+/* Drives the static brightness of many devices from one timerfd. Frames
+are computed from the elapsed time, so late ticks skip frames instead
+of slowing animations down. */
+struct PowerMateAnimator {
+	int fd;				 /* timerfd, ticking only while animating */
+	unsigned int rate;		 /* frames per second */
+	int armed;
+	PowerMateAnimation *animations;
+	unsigned int count;
+	unsigned int size;
+	unsigned char curves[POWERMATE_CURVES][POWERMATE_CURVE_STEPS];
+	unsigned long long int frames;
+	unsigned long long int writes;	 /* brightness words written */
+	unsigned long long int skipped;	 /* frame values equal to the LED state */
+	unsigned long long int failed;	 /* writes which failed */
+};
+
+/* Device registered in a PowerMateUring. Completions carry the slot
+index and generation, those of a removed device are recognized. */
+typedef struct {
+	PowerMate *pm;			 /* NULL if free */
+	PowerMateUring *uring;
+	const PowerMateTransport *transport; /* transport replaced while registered */
+	void *transport_data;
+	unsigned int generation;
+	int armed;			 /* a read is posted */
+	int buffer;			 /* provided buffer being dispatched, -1 if none */
+	size_t begin;			 /* bytes of it already consumed */
+	size_t end;
+	struct pm_event writes[POWERMATE_URING_WRITES]; /* LED words being written */
+	unsigned int writes_busy;	 /* a bit per writes[] entry in flight */
+	unsigned int writes_in_flight;
+} PowerMateUringSlot;
+
+struct PowerMateUring {
+	int fd;				 /* io_uring instance */
+	void *sq_ring;			 /* submission and completion rings (one mapping) */
+	size_t ring_size;
+	void *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int queued;		 /* entries not submitted yet */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	void *cqes;
+	unsigned int cq_mask;
+	void *buffer_ring;		 /* provided buffers, one read each */
+	size_t buffer_ring_size;
+	char *buffers;
+	unsigned int buffer_count;
+	unsigned int buffer_tail;
+	PowerMateUringSlot *slots;
+	unsigned int size;		 /* slots */
+	unsigned int count;		 /* registered devices */
+	int multishot;			 /* reads stay posted (Linux >= 6.7) */
+	unsigned int disarmed;		 /* devices whose read must be posted again */
+	PowerMate *pending;		 /* device stopped by a handler with events left */
+	PowerMate *failed;		 /* last device dropped because of a read error */
+	unsigned long long int enters;	 /* io_uring_enter() calls */
+	unsigned long long int completions;
+	unsigned long long int write_errors; /* LED writes completed with an error */
+};
+
+/*	Shared state segment
+
+	A header followed by one slot per device, each in its own cache
+	line. The publisher is the only writer; readers map the segment
+	read-only and copy a slot while its sequence is even and the same
+	before and after (seqlock), with no system calls nor locks.	*/
+
+#define POWERMATE_SHARED_MAGIC	 0x48534D50 /* "PMSH" */
+#define POWERMATE_SHARED_VERSION 1
+
+typedef struct {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int slots;
+	unsigned int reserved;
+	char padding[48];
+} PowerMateShared;
+
+typedef struct PowerMateSharedDevice {
+	unsigned int sequence;		 /* odd while the slot is being written */
+	unsigned int active;		 /* a device is published in the slot */
+	long long int position;		 /* rotation units accumulated since publishing */
+	long long int time;		 /* timestamp of the last event (microseconds) */
+	unsigned long long int events;	 /* state changes published */
+	unsigned int pressed;
+	unsigned int led;		 /* LED word, as written or echoed */
+	char padding[24];
+} PowerMateSharedDevice;
+
+/* Consistent copy of a slot */
+typedef struct {
+	long long int position;
+	long long int time;
+	unsigned long long int events;
+	unsigned int pressed;
+	unsigned int active;
+	PowerMateLED led;
+	unsigned int retries;		 /* copies discarded because a write overlapped */
+} PowerMateSample;
+
+struct PowerMatePublisher {
+	int fd;
+	char *path;			 /* unlinked when the publisher is destroyed */
+	PowerMateShared *shared;
+	size_t size;			 /* of the mapping */
+};
+
+typedef struct {
+	int fd;				 /* uinput descriptor */
+	char device[128];		 /* event node of the virtual knob */
+} PowerMateVirtual;
+
+PowerMateLoop*	powermate_loop_new		(void);
+int		powermate_loop_destroy		(PowerMateLoop *loop);
+int		powermate_loop_add		(PowerMateLoop *loop,
+						PowerMate *pm);
+int		powermate_loop_remove		(PowerMateLoop *loop,
+						PowerMate *pm);
+int		powermate_loop_add_watch	(PowerMateLoop *loop,
+						PowerMateWatch *watch);
+int		powermate_loop_remove_watch	(PowerMateLoop *loop);
+int		powermate_loop_add_animator	(PowerMateLoop *loop,
+						PowerMateAnimator *animator);
+int		powermate_loop_remove_animator	(PowerMateLoop *loop);
+int		powermate_loop_dispatch		(PowerMateLoop *loop,
+						int timeout);
+int		powermate_loop_run		(PowerMateLoop *loop);
+
+PowerMateUring*	powermate_uring_new		(unsigned int devices);
+int		powermate_uring_destroy		(PowerMateUring *uring);
+int		powermate_uring_add		(PowerMateUring *uring,
+						PowerMate *pm);
+int		powermate_uring_remove		(PowerMateUring *uring,
+						PowerMate *pm);
+int		powermate_uring_submit		(PowerMateUring *uring);
+int		powermate_uring_dispatch	(PowerMateUring *uring,
+						int timeout);
+int		powermate_uring_run		(PowerMateUring *uring);
+
+PowerMateAnimator* powermate_animator_new	(unsigned int rate);
+int		powermate_animator_destroy	(PowerMateAnimator *animator);
+int		powermate_animator_fade		(PowerMateAnimator *animator,
+						PowerMate *pm,
+						unsigned char brightness,
+						unsigned int duration,
+						PowerMateCurve curve);
+int		powermate_animator_breathe	(PowerMateAnimator *animator,
+						PowerMate *pm,
+						unsigned char low,
+						unsigned char high,
+						unsigned int period);
+int		powermate_animator_set_level	(PowerMateAnimator *animator,
+						PowerMate *pm,
+						unsigned char brightness);
+int		powermate_animator_stop		(PowerMateAnimator *animator,
+						PowerMate *pm);
+int		powermate_animator_dispatch	(PowerMateAnimator *animator);
+
+PowerMatePublisher* powermate_publisher_new	(const char *path,
+						unsigned int slots);
+int		powermate_publisher_destroy	(PowerMatePublisher *publisher);
+int		powermate_publish		(PowerMatePublisher *publisher,
+						PowerMate *pm,
+						unsigned int slot);
+int		powermate_unpublish		(PowerMate *pm);
+const PowerMateShared* powermate_shared_open	(const char *path);
+int		powermate_shared_close		(const PowerMateShared *shared);
+int		powermate_shared_read		(const PowerMateShared *shared,
+						unsigned int slot,
+						PowerMateSample *sample);
+
+PowerMateWatch*	powermate_watch_new		(const char *directory,
+						int flags,
+						PowerMateWatchFunc added,
+						PowerMateWatchFunc removed,
+						void *data);
+int		powermate_watch_destroy		(PowerMateWatch *watch);
+int		powermate_watch_scan		(PowerMateWatch *watch);
+int		powermate_watch_dispatch	(PowerMateWatch *watch);
+
+PowerMateCapture* powermate_capture_new		(const char *path);
+int		powermate_capture_destroy	(PowerMateCapture *capture);
+int		powermate_capture_event		(PowerMateCapture *capture,
+						struct pm_event *event);
+int		powermate_capture_flush		(PowerMateCapture *capture);
+PowerMateReplay* powermate_replay_new		(const char *path,
+						PowerMateReplayPacing pacing);
+int		powermate_replay_destroy	(PowerMateReplay *replay);
+int		powermate_replay_rewind		(PowerMateReplay *replay);
+ssize_t		powermate_replay_read		(PowerMateReplay *replay,
+						void *buffer,
+						size_t size);
+
+PowerMateVirtual* powermate_virtual_new		(void);
+int		powermate_virtual_destroy	(PowerMateVirtual *knob);
+int		powermate_virtual_rotate	(PowerMateVirtual *knob,
+						int units);
+int		powermate_virtual_button	(PowerMateVirtual *knob,
+						int pressed);
+int		powermate_virtual_get_led	(PowerMateVirtual *knob,
+						unsigned int *word);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __POWERMATE_H__ */
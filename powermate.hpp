@@ -0,0 +1,182 @@
+/*
+	libpowermate v1.0
+	A very tiny library for Griffin Powermate control and handling.
+
+	Copyright(C) 2004, 2005 Manuel Sainz de Baranda Goñi
+	Distributed under the terms of the GNU Lesser General Public License version 2.1
+
+	This file is part of libpowermate.
+
+	libpowermate is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+
+#ifndef __POWERMATE_HPP__
+#define __POWERMATE_HPP__
+
+#include "powermate.h"
+#include <cerrno>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+/*	C++17 interface
+
+	powermate::Device<Handler> owns a PowerMate and dispatches its
+	events straight to the member functions of Handler:
+
+		void on_left(const powermate::Event &event);
+		void on_right(const powermate::Event &event);
+		void on_down(const powermate::Event &event);
+		void on_up(const powermate::Event &event);
+		void on_led(const powermate::Event &event);
+
+	The calls are resolved at compile time, so they can be inlined,
+	and the events Handler has no member for compile away. Events
+	are decoded with powermate_poll_events(), handlers of the C
+	PowerMateHandlers table are not used.				*/
+
+namespace powermate {
+
+typedef PowerMateEvent Event;
+
+namespace detail {
+
+#define POWERMATE_HPP_DETECT(name)							\
+	template <class H, class = void> struct has_##name : std::false_type {};	\
+											\
+	template <class H> struct has_##name<H, std::void_t<decltype(			\
+		std::declval<H &>().name(std::declval<const Event &>()))>		\
+	> : std::true_type {};
+
+POWERMATE_HPP_DETECT(on_left)
+POWERMATE_HPP_DETECT(on_right)
+POWERMATE_HPP_DETECT(on_down)
+POWERMATE_HPP_DETECT(on_up)
+POWERMATE_HPP_DETECT(on_led)
+
+#undef POWERMATE_HPP_DETECT
+
+}
+
+
+template <class Handler> class Device {
+public:
+	/* Opens an evdev node, throws std::system_error on failure */
+
+	explicit Device(const char *device, Handler handler = Handler())
+	: pm(powermate_new(device, NULL)), handler_(std::move(handler))
+	{
+		if (pm == NULL) throw std::system_error(errno, std::generic_category(), device);
+	}
+
+	/* The same with POWERMATE_OPEN_* flags */
+
+	Device(const char *device, int flags, Handler handler = Handler())
+	: pm(powermate_new_options(device, flags, NULL)), handler_(std::move(handler))
+	{
+		if (pm == NULL) throw std::system_error(errno, std::generic_category(), device);
+	}
+
+	/* Takes ownership of a device created with the C interface */
+
+	explicit Device(PowerMate *pm, Handler handler = Handler()) noexcept
+	: pm(pm), handler_(std::move(handler)) {}
+
+	Device(Device &&other) noexcept
+	: pm(other.pm), handler_(std::move(other.handler_))
+	{
+		other.pm = NULL;
+	}
+
+	Device &operator =(Device &&other) noexcept
+	{
+		if (this != &other) {
+			if (pm != NULL) powermate_destroy(pm);
+			pm = other.pm;
+			handler_ = std::move(other.handler_);
+			other.pm = NULL;
+		}
+
+		return *this;
+	}
+
+	Device(const Device &) = delete;
+	Device &operator =(const Device &) = delete;
+
+	~Device()
+	{
+		if (pm != NULL) powermate_destroy(pm);
+	}
+
+	PowerMate *get() const noexcept {return pm;}
+	Handler &handler() noexcept {return handler_;}
+
+	/* Dispatches what the device has ready, waiting up to timeout
+	milliseconds (-1 forever) if nothing is. Returns the events
+	dispatched, or -1 with errno set. */
+
+	int dispatch(int timeout = -1)
+	{
+		Event events[POWERMATE_BUFFER_EVENTS];
+		int count = powermate_poll_events(pm, events, POWERMATE_BUFFER_EVENTS, timeout), index;
+
+		for (index = 0; index < count; index++) deliver(events[index]);
+		return count;
+	}
+
+	int set_led(const PowerMateLED &led)
+	{
+		PowerMateLED copy = led;
+
+		return powermate_set_led(pm, &copy);
+	}
+
+private:
+	PowerMate *pm;
+	Handler handler_;
+
+	void deliver(const Event &event)
+	{
+		switch (event.kind) {
+			case POWERMATE_HANDLER_LEFT:
+			if constexpr (detail::has_on_left<Handler>::value) handler_.on_left(event);
+			break;
+
+			case POWERMATE_HANDLER_RIGHT:
+			if constexpr (detail::has_on_right<Handler>::value) handler_.on_right(event);
+			break;
+
+			case POWERMATE_HANDLER_DOWN:
+			if constexpr (detail::has_on_down<Handler>::value) handler_.on_down(event);
+			break;
+
+			case POWERMATE_HANDLER_UP:
+			if constexpr (detail::has_on_up<Handler>::value) handler_.on_up(event);
+			break;
+
+			case POWERMATE_HANDLER_LED:
+			if constexpr (detail::has_on_led<Handler>::value) handler_.on_led(event);
+			break;
+
+			default: break;
+		}
+	}
+};
+
+}
+
+#endif /* __POWERMATE_HPP__ */